@@ -0,0 +1,64 @@
+/* ===========================================================================
+ *        Filename:  arena.cc
+ *     Description:  Simple bump allocator with bulk release
+ *
+ *         Version:  $Rev$
+ *         Changed:  $Date$
+ *         Licence:  GPL (read COPYING file for details)
+ *
+ *          Author:  Erich Schubert (eS), erich@debian.org
+ *                   Institut für Informatik, LMU München
+ * ======================================================================== */
+#include "arena.h"
+#include <cstdlib>
+
+namespace SSD {
+
+/* size of the block header, rounded up so the data is aligned */
+#define ARENA_HEADER ((sizeof(Block) + 15) & ~(size_t)15)
+
+Arena::Arena(size_t bs) : head(NULL), blocksize(bs), reserved(0) { }
+
+Arena::~Arena() {
+	release();
+}
+
+void*
+Arena::alloc(size_t n, size_t align) {
+	if (head) {
+		size_t pos = (head->used + align - 1) & ~(align - 1);
+		if (pos + n <= head->size) {
+			head->used = pos + n;
+			return (char*) head + ARENA_HEADER + pos;
+		}
+	}
+	/* start a new block; oversized requests get a block of their own */
+	size_t size = (n + align > blocksize) ? n + align : blocksize;
+	Block* b = (Block*) malloc(ARENA_HEADER + size);
+	if (!b) throw "Arena::alloc - out of memory";
+	b->size = size;
+	b->used = 0;
+	reserved += ARENA_HEADER + size;
+	/* keep filling the current block if the new one is a one-off */
+	if (head && size > blocksize && head->size - head->used >= align) {
+		b->next = head->next;
+		head->next = b;
+	} else {
+		b->next = head;
+		head = b;
+	}
+	b->used = n;
+	return (char*) b + ARENA_HEADER;
+}
+
+void
+Arena::release() {
+	while (head) {
+		Block* next = head->next;
+		free(head);
+		head = next;
+	}
+	reserved = 0;
+}
+
+}
@@ -0,0 +1,65 @@
+/* ===========================================================================
+ *        Filename:  arena.h
+ *     Description:  Simple bump allocator with bulk release
+ *
+ *         Version:  $Rev$
+ *         Changed:  $Date$
+ *         Licence:  GPL (read COPYING file for details)
+ *
+ *          Author:  Erich Schubert (eS), erich@debian.org
+ *                   Institut für Informatik, LMU München
+ * ======================================================================== */
+#ifndef  SSD_ARENA_H
+#define  SSD_ARENA_H
+
+#include "config.h"
+#include <cstddef>
+
+namespace SSD {
+
+/** \brief Bump allocator for many small objects of the same lifetime
+ *
+ *  Memory is taken from large blocks and never returned individually.
+ *  Everything allocated from the arena is released at once, either by
+ *  release() or when the arena is destroyed. No destructors are run. */
+class Arena {
+private:
+	/** \brief header of a memory block, data follows directly */
+	struct Block {
+		/** \brief previously filled block */
+		Block*	next;
+		/** \brief usable size of this block */
+		size_t	size;
+		/** \brief bytes used in this block */
+		size_t	used;
+	};
+	/** \brief block currently allocated from */
+	Block*	head;
+	/** \brief default size for new blocks */
+	size_t	blocksize;
+	/** \brief total bytes reserved from the system */
+	size_t	reserved;
+
+	/** \brief no copying, the arena owns its blocks */
+	Arena(const Arena&);
+	/** \brief no copying, the arena owns its blocks */
+	Arena& operator=(const Arena&);
+public:
+	/** \brief make a new, empty arena
+	 *  \param bs size of the blocks requested from the system */
+	Arena(size_t bs = 64*1024);
+	/** \brief destructor, releasing all blocks */
+	~Arena();
+	/** \brief allocate uninitialized memory
+	 *  \param n number of bytes needed
+	 *  \param align alignment of the memory, must be a power of two
+	 *  \return pointer to the memory, never NULL */
+	void* alloc(size_t n, size_t align = sizeof(void*));
+	/** \brief release all memory allocated from this arena */
+	void release();
+	/** \brief number of bytes reserved from the system */
+	size_t bytes() const { return reserved; }
+};
+
+}
+#endif   /* ----- #ifndef SSD_ARENA_H  ----- */
@@ -0,0 +1,126 @@
+/* ===========================================================================
+ *        Filename:  assignment_map.cc
+ *     Description:  Persistent map from node ids to node assignments
+ *
+ *         Version:  $Rev$
+ *         Changed:  $Date$
+ *         Licence:  GPL (read COPYING file for details)
+ *
+ *          Author:  Erich Schubert (eS), erich@debian.org
+ *                   Institut für Informatik, LMU München
+ * ======================================================================== */
+#include "assignment_map.h"
+#include "util.h"
+#include <cstdlib>
+
+namespace SSD {
+
+/* bits of the key used per trie level */
+#define TRIE_BITS 4
+#define TRIE_MASK ((1U << TRIE_BITS) - 1)
+
+/* number of bits set in a slot bitmap */
+static inline unsigned int popcount16(unsigned int x) {
+	x = x - ((x >> 1) & 0x5555);
+	x = (x & 0x3333) + ((x >> 2) & 0x3333);
+	x = (x + (x >> 4)) & 0x0f0f;
+	return (x + (x >> 8)) & 0x1f;
+}
+
+/* size of a trie node with n slots */
+#define TRIE_SIZE(n) (sizeof(Trie) + ((n) ? (n) - 1 : 0) * sizeof(void*))
+
+__thread MemoryPool* AssignmentMap::pool = NULL;
+
+AssignmentMap::Trie*
+AssignmentMap::alloc(unsigned int bitmap) {
+	unsigned int n = popcount16(bitmap);
+	Trie* t = (Trie*) (pool ? pool->alloc(TRIE_SIZE(n)) : malloc(TRIE_SIZE(n)));
+	if (!t) throw "AssignmentMap - out of memory";
+	t->refcount = 1;
+	t->bitmap = bitmap;
+	return t;
+}
+
+void
+AssignmentMap::release(Trie* t, unsigned int shift) {
+	if (!t || REF_DEC(t->refcount)) return;
+	unsigned int n = popcount16(t->bitmap);
+	if (shift)
+		for (unsigned int i = 0; i < n; i++)
+			release((Trie*) t->slot[i], shift - TRIE_BITS);
+	if (pool)
+		pool->free(t, TRIE_SIZE(n));
+	else
+		free(t);
+}
+
+AssignmentMap::AssignmentMap(const AssignmentMap& other) : root(other.root), shift(other.shift) {
+	if (root) REF_INC(root->refcount);
+}
+
+AssignmentMap&
+AssignmentMap::operator=(const AssignmentMap& other) {
+	if (other.root) REF_INC(other.root->refcount);
+	release(root, shift);
+	root = other.root;
+	shift = other.shift;
+	return *this;
+}
+
+const NodeAssignments*
+AssignmentMap::find(unsigned int key) const {
+	if (!root || (shift + TRIE_BITS < 32 && (key >> (shift + TRIE_BITS)))) return NULL;
+	const Trie* t = root;
+	for (unsigned int s = shift; ; s -= TRIE_BITS) {
+		unsigned int bit = 1U << ((key >> s) & TRIE_MASK);
+		if (!(t->bitmap & bit)) return NULL;
+		void* next = t->slot[popcount16(t->bitmap & (bit - 1))];
+		if (!s) return (const NodeAssignments*) next;
+		t = (const Trie*) next;
+	}
+}
+
+AssignmentMap::Trie*
+AssignmentMap::set(Trie* t, unsigned int shift, unsigned int key, const NodeAssignments* value) {
+	unsigned int bit = 1U << ((key >> shift) & TRIE_MASK);
+	unsigned int old = t ? t->bitmap : 0;
+	unsigned int pos = popcount16(old & (bit - 1));
+	/* not shared with any other map: change in place */
+	if (t && REF_GET(t->refcount) == 1 && (old & bit)) {
+		if (shift)
+			t->slot[pos] = set((Trie*) t->slot[pos], shift - TRIE_BITS, key, value);
+		else
+			t->slot[pos] = (void*) value;
+		return t;
+	}
+	unsigned int n = popcount16(old);
+	Trie* c = alloc(old | bit);
+	/* share all slots; a new slot is inserted at pos */
+	for (unsigned int i = 0; i < n; i++) {
+		c->slot[(i < pos || (old & bit)) ? i : i + 1] = t->slot[i];
+		if (shift) REF_INC(((Trie*) t->slot[i])->refcount);
+	}
+	if (shift)
+		c->slot[pos] = set((old & bit) ? (Trie*) c->slot[pos] : NULL, shift - TRIE_BITS, key, value);
+	else
+		c->slot[pos] = (void*) value;
+	release(t, shift);
+	return c;
+}
+
+void
+AssignmentMap::insert(unsigned int key, const NodeAssignments* value) {
+	/* add levels on top until the key fits */
+	while (root && shift + TRIE_BITS < 32 && (key >> (shift + TRIE_BITS))) {
+		Trie* top = alloc(1);
+		top->slot[0] = root;
+		root = top;
+		shift += TRIE_BITS;
+	}
+	if (!root)
+		while (shift + TRIE_BITS < 32 && (key >> (shift + TRIE_BITS))) shift += TRIE_BITS;
+	root = set(root, shift, key, value);
+}
+
+}
@@ -0,0 +1,101 @@
+/* ===========================================================================
+ *        Filename:  assignment_map.h
+ *     Description:  Persistent map from node ids to node assignments
+ *
+ *         Version:  $Rev$
+ *         Changed:  $Date$
+ *         Licence:  GPL (read COPYING file for details)
+ *
+ *          Author:  Erich Schubert (eS), erich@debian.org
+ *                   Institut für Informatik, LMU München
+ * ======================================================================== */
+#ifndef  SSD_ASSIGNMENT_MAP_H
+#define  SSD_ASSIGNMENT_MAP_H
+
+#include "config.h"
+#include "pool.h"
+#include <cstddef>
+
+namespace SSD {
+
+class NodeAssignments;
+
+/** \brief Persistent map from node ids to node assignments
+ *
+ *  A trie over the node ids with 16 children per level, where each trie
+ *  node only stores its present children, indexed by a bitmap (like a
+ *  hash array mapped trie, but on the dense node ids directly).
+ *
+ *  Copying a map is constant time, the trie is shared. Inserting copies
+ *  only the path to the changed entry and shares everything else, so a
+ *  search state can extend the map of its parent state cheaply. Trie
+ *  nodes are reference counted and freed with the last map using them;
+ *  trie nodes used by a single map only are changed in place.
+ *
+ *  Lookups and inserts take O(log16 n) steps for n nodes.
+ *
+ *  Trie nodes are taken from the heap, or from a pool set with usePool(),
+ *  so that they can be dropped along with the other search memory. The
+ *  pool is set per thread; trie nodes are returned to the pool of the
+ *  thread releasing them, and reference counts are changed atomically,
+ *  so maps sharing trie nodes can be used by different threads. */
+class AssignmentMap {
+private:
+	/** \brief trie node, allocated with room for all present slots */
+	struct Trie {
+		/** \brief number of maps and trie nodes referring to this */
+		unsigned int	refcount;
+		/** \brief present slots, bit i set if slot i is present */
+		unsigned int	bitmap;
+		/** \brief present slots: child nodes, or values on the lowest level */
+		void*		slot[1];
+	};
+	/** \brief root of the trie, NULL for an empty map */
+	Trie*		root;
+	/** \brief shift of the key bits used on the root level */
+	unsigned int	shift;
+	/** \brief pool for the trie nodes of this thread, NULL to use the heap */
+	static __thread MemoryPool*	pool;
+
+	/** \brief allocate a trie node with uninitialized slots
+	 *  \param bitmap present slots */
+	static Trie* alloc(unsigned int bitmap);
+	/** \brief drop a reference to a trie node
+	 *  \param t trie node, may be NULL
+	 *  \param shift shift of the level of the node */
+	static void release(Trie* t, unsigned int shift);
+	/** \brief set the value of a key, copying the path where it is shared
+	 *  \param t trie node, may be NULL; the reference of the caller is taken over
+	 *  \param shift shift of the level of the node
+	 *  \param key key to be set
+	 *  \param value value to be set
+	 *  \return changed or new trie node, with one reference for the caller */
+	static Trie* set(Trie* t, unsigned int shift, unsigned int key, const NodeAssignments* value);
+public:
+	/** \brief take the trie nodes of the maps changed by this thread from a pool
+	 *
+	 *  only to be changed while no map has trie nodes.
+	 *  \param p pool, NULL to use the heap */
+	static void usePool(MemoryPool* p) { pool = p; }
+	/** \brief make an empty map */
+	AssignmentMap() : root(NULL), shift(0) {};
+	/** \brief copy a map, sharing the trie
+	 *  \param other map to be copied */
+	AssignmentMap(const AssignmentMap& other);
+	/** \brief copy a map, sharing the trie
+	 *  \param other map to be copied */
+	AssignmentMap& operator=(const AssignmentMap& other);
+	/** \brief destructor, releasing the trie */
+	~AssignmentMap() { release(root, shift); }
+	/** \brief find an entry
+	 *  \param key node id
+	 *  \return assignment of the node, NULL if not assigned */
+	const NodeAssignments* find(unsigned int key) const;
+	/** \brief add or replace an entry; other maps sharing the trie are unchanged
+	 *  \param key node id
+	 *  \param value assignment of the node, not NULL */
+	void insert(unsigned int key, const NodeAssignments* value);
+};
+
+}
+#endif   /* ----- #ifndef SSD_ASSIGNMENT_MAP_H  ----- */
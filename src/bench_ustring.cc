@@ -0,0 +1,53 @@
+/* ===========================================================================
+ *        Filename:  bench_ustring.cc
+ *     Description:  Micro benchmark for the ustring interning table
+ *
+ *         Version:  $Rev$
+ *         Changed:  $Date$
+ *         Licence:  GPL (read COPYING file for details)
+ *
+ *          Author:  Erich Schubert (eS), erich@debian.org
+ *                   Institut für Informatik, LMU München
+ * ======================================================================== */
+#include "ustring.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+#include <iostream>
+
+using namespace SSD;
+
+/* Interns n distinct strings, then looks all of them up a second time.
+ * The time per string should stay (roughly) constant as n grows. */
+static void run(unsigned int n, unsigned int offset) {
+	std::vector<char*> strings;
+	char buf[64];
+	for (unsigned int i = 0; i < n; i++) {
+		snprintf(buf, sizeof(buf), "label-%u-%u", offset, i);
+		strings.push_back(strdup(buf));
+	}
+
+	clock_t start = clock();
+	for (unsigned int i = 0; i < n; i++) ustring u(strings[i]);
+	clock_t mid = clock();
+	for (unsigned int i = 0; i < n; i++) ustring u(strings[i]);
+	clock_t end = clock();
+
+	double insert = (double) (mid - start) / CLOCKS_PER_SEC;
+	double lookup = (double) (end - mid) / CLOCKS_PER_SEC;
+	std::cout << n << "\t" << insert << "s\t" << (insert * 1e9 / n) << "ns/insert\t"
+		<< lookup << "s\t" << (lookup * 1e9 / n) << "ns/lookup" << std::endl;
+
+	for (unsigned int i = 0; i < n; i++) free(strings[i]);
+}
+
+int main(int argc, char** argv) {
+	unsigned int max = (argc > 1) ? atoi(argv[1]) : 1000000;
+	std::cout << "unique\tinsert\t\t\tlookup" << std::endl;
+	unsigned int round = 0;
+	for (unsigned int n = 1000; n <= max; n *= 10)
+		run(n, round++);
+	return 0;
+}
@@ -10,7 +10,13 @@
  *                   Institut für Informatik, LMU München
  * ========================================================================= */
 #include "diff.h"
+#include <algorithm>
+#include <new>
 #include <vector>
+#include <climits>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
 
 #ifdef VERBOSE
 # include <iostream>
@@ -19,6 +25,17 @@
 namespace SSD {
 
 bool DiffDijkstra::fastApproximativeMode = false;
+bool DiffDijkstra::prematchSubtrees = true;
+unsigned int DiffDijkstra::beamWidth = 0;
+double DiffDijkstra::weight = 0;
+size_t DiffDijkstra::queueLimit = 0;
+double DiffDijkstra::deadline = 0;
+double DiffDijkstra::started = 0;
+unsigned int DiffDijkstra::threads = 1;
+
+/* share of the queue limit evicted at once, so the worst bucket is not
+ * sorted again for every state added */
+#define EVICT_SHARE 8
 
 /* constructor, adding the root nodes */
 DiffDijkstra::DiffDijkstra(Doc& eins, Doc& zwei)
@@ -27,106 +44,268 @@ DiffDijkstra::DiffDijkstra(Doc& eins, Doc& zwei)
 		seq(0),
 #endif
 		best_retained(0), max_retained(0),
-		steps(0), result(NULL) {
+		steps(0), credit(NULL), worklist(pool), incumbent(NULL), shared(NULL), worker(0),
+		call(0), result(NULL), optimal(false) {
+}
+
+/* size of a cache line, to keep the inboxes of the threads apart */
+#define CACHE_LINE 64
+
+/** \brief state sent to another thread of a parallel search */
+struct StateMessage {
+	/** \brief the state */
+	DiffDijkstraState*	state;
+	/** \brief next message in the inbox */
+	StateMessage*		next;
+};
+
+/** \brief lock-free list of the states sent to a thread
+ *
+ *  any thread pushes to it, the owner takes all messages at once, so
+ *  there is no ABA problem.
+ *
+ *  The fields shared by the threads, here and in ParallelSearch, are
+ *  only accessed with atomic operations, unless the other threads wait
+ *  at the barrier. */
+struct Inbox {
+	/** \brief last message sent, NULL if none */
+	StateMessage*		head;
+	/** \brief set by the owner when it has no states of the current costs, cleared by the thread sending it one */
+	bool			idle;
+	/** \brief padding to a cache line */
+	char			pad[CACHE_LINE - sizeof(StateMessage*) - sizeof(bool)];
+};
+
+/** \brief barrier the threads of a parallel search wait at between the costs searched
+ *
+ *  unlike pthread_barrier_t, it can be aborted, so a thread that fails
+ *  does not leave the others waiting for it. */
+struct LevelBarrier {
+	/** \brief lock for the other fields */
+	pthread_mutex_t		lock;
+	/** \brief signalled when all threads arrived, or on abort */
+	pthread_cond_t		cond;
+	/** \brief number of threads to wait for */
+	unsigned int		count;
+	/** \brief number of threads waiting */
+	unsigned int		waiting;
+	/** \brief number of times all threads arrived */
+	unsigned int		generation;
+	/** \brief set once aborted, waiting returns at once afterwards */
+	bool			aborted;
+
+	/** \brief set up the barrier
+	 *  \param n number of threads to wait for */
+	void init(unsigned int n) {
+		pthread_mutex_init(&lock, NULL);
+		pthread_cond_init(&cond, NULL);
+		count = n;
+		waiting = 0;
+		generation = 0;
+		aborted = false;
+	}
+	/** \brief destroy the barrier, no thread may be waiting */
+	void destroy() {
+		pthread_cond_destroy(&cond);
+		pthread_mutex_destroy(&lock);
+	}
+	/** \brief wait for all threads
+	 *  \return false if the barrier was aborted */
+	bool wait() {
+		pthread_mutex_lock(&lock);
+		unsigned int g = generation;
+		if (!aborted && ++waiting == count) {
+			waiting = 0;
+			generation++;
+			pthread_cond_broadcast(&cond);
+		}
+		while (g == generation && !aborted)
+			pthread_cond_wait(&cond, &lock);
+		bool passed = (g != generation);
+		pthread_mutex_unlock(&lock);
+		return passed;
+	}
+	/** \brief release all threads waiting now or later */
+	void abort() {
+		pthread_mutex_lock(&lock);
+		aborted = true;
+		pthread_cond_broadcast(&cond);
+		pthread_mutex_unlock(&lock);
+	}
+};
+
+struct ParallelSearch {
+	/** \brief number of threads searching */
+	unsigned int		threads;
+	/** \brief searches of the threads, index 0 is the main search */
+	vector<DiffDijkstra*>	workers;
+	/** \brief states sent to the threads, by thread index */
+	vector<Inbox>		inbox;
+	/** \brief number of states of the current costs queued, sent or being expanded in any thread */
+	long			pending;
+	/** \brief best retained value of all threads */
+	int			bestRetained;
+	/** \brief lowest costs queued in any thread, INT_MAX if none */
+	int			nextLevel;
+	/** \brief set when a complete state of the current costs was found */
+	bool			final;
+	/** \brief the threads wait for each other between the costs searched */
+	LevelBarrier		barrier;
+	/** \brief set once all threads were started */
+	bool			go;
+	/** \brief set when a thread failed, to stop the others */
+	bool			stop;
+	/** \brief first exception raised by a thread, NULL if none, set before stop */
+	const char*		error;
+	/** \brief end of the nodes to be matched, i.e. the position of complete states */
+	NodeVec::const_iterator	end;
+};
+
+DiffDijkstra::DiffDijkstra(DiffDijkstra& master, ParallelSearch* ps, unsigned int index)
+: Diff(*master.doc1, *master.doc2),
+#ifdef VERBOSE_SEQCOUNT
+		seq(0),
+#endif
+		best_retained(0), max_retained(master.max_retained),
+		steps(0), credit(new RelCount(*master.credit)), worklist(pool), incumbent(NULL),
+		shared(ps), worker(index), class1(master.class1), class2(master.class2),
+		classCredits(master.classCredits), found(master.found.size(), 0),
+		call(0), result(NULL), optimal(false) {
+	for (int dir = 0; dir < 2; dir++)
+		first[dir] = master.first[dir];
 }
 
 DiffDijkstra::~DiffDijkstra() {
+	/* a search that was interrupted: its states and maps use the pool */
+	if (credit) {
+		worklist.clear();
+		credit->moveTo(NULL, pool);
+		delete credit;
+		AssignmentMap::usePool(NULL);
+	}
+	dropWorkers();
 	if (result) delete result;
 }
 
+/* RelCount slot of the relation at an iterator, for the relation class (a, b) */
+static inline unsigned int relationSlot(const RelList::iterator& i, const Node* a, const Node* b) {
+	return i.annotated() ? i.slot() : RelCount::slot(RelEqClass(a, b));
+}
+
+void
+DiffDijkstra::prepareRelations(const DiffDijkstraState* state) {
+	Node* n1 = *(state->iter);
+	for (int dir = 1; dir <= 2; dir++) {
+		FirstRelations& fr = first[dir - 1];
+		/* drop the relations of the previous expansion */
+		for (vector<ExpectedRelation>::iterator i = fr.expected.begin(); i != fr.expected.end(); ++i)
+			fr.expecting[i->n2->id] = false;
+		fr.expected.clear();
+		fr.unmatched.clear();
+
+		RelList rn1 = (dir == 1) ? doc1->reldown[n1] : doc1->relup[n1];
+		for (RelList::iterator i1 = rn1.begin(); i1 != rn1.end(); i1++) {
+			const NodeAssignments* f = state->findNodeAssignment1(*i1);
+			/* nodes are only matched within their class, so the relation to
+			 * f->n2 has the same class as the one to *i1 */
+			unsigned int slot = (dir == 1) ? relationSlot(i1, n1, *i1) : relationSlot(i1, *i1, n1);
+			/* register node to be found */
+			if (f) {
+				/* dropping nodes always loses us the relation. */
+				if (f->n2 && !fr.expecting[f->n2->id]) {
+					ExpectedRelation e = { f->n2, slot };
+					fr.expected.push_back(e);
+					fr.expecting[f->n2->id] = true;
+				}
+				/* if f->n2 == NULL, the node was dropped, costs have been calculated before */
+				/* since we calculate these when dropping the first node */
+			} else {
+				/* do this also when dropping n1? */
+				/* still unmatched node, add to local credits */
+				unsigned int cls = class1[(*i1)->id];
+				if (!classCredits[cls].count) touched.push_back(cls);
+				classCredits[cls].count += 1;
+				classCredits[cls].slot = slot;
+			}
+		}
+		/* keep the local credits by class, and reset the counters */
+		for (vector<unsigned int>::iterator i = touched.begin(); i != touched.end(); ++i) {
+			ClassCount c = { *i, classCredits[*i].count, classCredits[*i].slot };
+			fr.unmatched.push_back(c);
+			classCredits[*i].count = 0;
+		}
+		touched.clear();
+	}
+}
+
 int
-process_relations(
-		Node* n1, Node* n2, RelCount* rc,
+DiffDijkstra::process_relations(
+		Node* n2, RelCount* rc,
 		int dir, /* "up" or "down" relations */
 		const DiffDijkstraState* state,
-		map<NodeEqClass,int>** c /* return parameter: local credits */,
 		int* retained) {
-
-	NodeVec* rn1;
-	NodeVec* rn2;
-	if (dir == 1) { rn1 = n1->reldown; rn2 = n2 ? n2->reldown : NULL; }
-	if (dir == 2) { rn1 = n1->relup;   rn2 = n2 ? n2->relup   : NULL; }
-
+	const FirstRelations& fr = first[dir - 1];
 	int cost=0;
-	NodeVec::iterator i1, i2;
-	/* local credits counter */
-	map<NodeEqClass,int>* count = new map<NodeEqClass,int>;
-	/* this set contains the nodes we must be related to in the second document */
-	/* because we are related to them in the first */
-	set<Node*> rel;
-
-	/* first make a list of nodes we need to find in the second list */
-	if (rn1)
-	for (i1=rn1->begin(); i1 != rn1->end(); i1++) {
-		const NodeAssignments* f = state->findNodeAssignment1(*i1);
-		/* register node to be found */
-		if (f) {
-			/* dropping nodes always loses us the relation. */
-			if (f->n2) rel.insert(f->n2);
-			/* if f->n2 == NULL, the node was dropped, costs have been calculated before */
-			/* since we calculate these when dropping the first node */
-		} else {
-			/* do this also when dropping n1? */
-			/* still unmatched node, add to local credits */
-			NodeEqClass cp(*i1);
-			(*count)[cp] = 1 + (*count)[cp];
-		}
+	/* number this call, for the marks in found */
+	if (++call == 0) {
+		found.assign(found.size(), 0);
+		call = 1;
+	}
+
+	/* start the local credits from the first document */
+	for (vector<ClassCount>::const_iterator i = fr.unmatched.begin(); i != fr.unmatched.end(); ++i) {
+		touched.push_back(i->cls);
+		classCredits[i->cls].count = i->count;
+		classCredits[i->cls].slot = i->slot;
 	}
-	
+
 	/* now check for matching nodes in the second documents relation */
-	if (n2 && rn2)
-	for (i2=rn2->begin(); i2 != rn2->end(); i2++) {
-		/* did we already map this node? */
-		const NodeAssignments* f = state->findNodeAssignment2(*i2);
-		if (f) {
-			/* to which node did we map it? */
-			set<Node*>::iterator f2 = rel.find(*i2);
-			if (f2 != rel.end()) {
-				/* we have the matching node on the other side, too - optimal */
-				/* no costs, and one node/relation less to care for */
-				(*retained)++;
-				rel.erase(f2);
-			} else {
-				/* we cannot retain this relation */
-				if (dir == 1) {
-					int lcost = rc->modify(RelEqClass(*n2,*i2), -1);
-					cost += lcost;
-				}
-				if (dir == 2) {
-					int lcost = rc->modify(RelEqClass(*i2,*n2), -1);
-					cost += lcost;
+	if (n2) {
+		RelList rn2 = (dir == 1) ? doc2->reldown[n2] : doc2->relup[n2];
+		for (RelList::iterator i2 = rn2.begin(); i2 != rn2.end(); i2++) {
+			unsigned int slot = (dir == 1) ? relationSlot(i2, n2, *i2) : relationSlot(i2, *i2, n2);
+			/* did we already map this node? */
+			const NodeAssignments* f = state->findNodeAssignment2(*i2);
+			if (f) {
+				/* to which node did we map it? */
+				if (fr.expecting[(*i2)->id] && found[(*i2)->id] != call) {
+					/* we have the matching node on the other side, too - optimal */
+					/* no costs, and one node/relation less to care for */
+					(*retained)++;
+					found[(*i2)->id] = call;
+				} else {
+					/* we cannot retain this relation */
+					cost += rc->modify(slot, -1);
 				}
+			} else {
+				/* this node is still unmatched, add to local credits */
+				unsigned int cls = class2[(*i2)->id];
+				if (!classCredits[cls].count) touched.push_back(cls);
+				classCredits[cls].count -= 1;
+				classCredits[cls].slot = slot;
 			}
-		} else {
-			/* this node is still unmatched, add to local credits */
-			NodeEqClass cp(*i2);
-			(*count)[cp] = -1 + (*count)[cp];
 		}
 	}
 #ifdef I_HAVE_FOUND_A_WAY_TO_MAKE_THIS_WORK_PROPERLY
 	if (!n2) {
 		cost *=2;
-		map<NodeEqClass,int>::iterator i3;
-		for (i3 = count->begin(); i3 != count->end(); i3++) {
-			i3->second *= 2;
-		}
+		for (vector<unsigned int>::iterator i = touched.begin(); i != touched.end(); ++i)
+			classCredits[*i].count *= 2;
 	}
 #endif
 	/* now process remaining nodes in the first document */
-	for(set<Node*>::iterator i = rel.begin(); i != rel.end(); i = rel.begin()) {
-		if (dir == 1) {
-			int lcost = rc->modify(RelEqClass(*n1,*i ), n2 ? +1 : +2);
-			cost += lcost;
-		}
-		if (dir == 2) {
-			int lcost = rc->modify(RelEqClass(*i ,*n1), n2 ? +1 : +2);
-			cost += lcost;
-		}
-		rel.erase(i);
-	}
+	for (vector<ExpectedRelation>::const_iterator i = fr.expected.begin(); i != fr.expected.end(); ++i)
+		if (found[i->n2->id] != call)
+			cost += rc->modify(i->slot, n2 ? +1 : +2);
 
-	/* we now have the expected (minimal) loss of relations in count */
-	*c = count;
+	/* we now have the expected (minimal) loss of relations in the local credits */
+	/* a class may be touched more than once if its count went back to zero */
+	for (vector<unsigned int>::iterator i = touched.begin(); i != touched.end(); ++i) {
+		ClassCredit& cc = classCredits[*i];
+		if (cc.count) cost += rc->modify(cc.slot, cc.count);
+		cc.count = 0;
+	}
+	touched.clear();
 	return cost;
 }
 
@@ -134,43 +313,23 @@ DiffDijkstraState*
 DiffDijkstra::makeState(const DiffDijkstraState* state, NodeVec::const_iterator n1, Node* n2) {
 	int cost=0;
 	int retained=0;
-	RelCount* rc = new RelCount(*(state->credit));
+	credit->moveTo(state->credit, pool);
 #ifdef VERBOSE_COSTS_2
 	cout << "Calculating costs for matching " << (**n1) << " with ";
 	if (n2) { cout << *n2; } else { cout << "NONE"; }
 	cout << "." << endl;
 #endif
 
-//	NodeVec::iterator i1, i2;
-	map<NodeEqClass,int>* count;
-	cost += process_relations(*n1, n2, rc, 1, state, &count, &retained);
+	cost += process_relations(n2, credit, 1, state, &retained);
 #ifdef VERBOSE_COSTS_3
 	cout << "Costs after process_relations down " << cost << endl;
 #endif
-
-	map<NodeEqClass,int>::iterator i3;
-	for (i3 = count->begin(); i3 != count->end(); i3++) {
-		int lcost = rc->modify(RelEqClass(**n1,i3->first), i3->second);
-		cost += lcost;
-	}
-
-#ifdef VERBOSE_COSTS_4
-	cout << "Costs with remaining nodes: " << cost << endl;
-#endif
-	//count.clear();
-	delete(count);
 	/* up relations */
-	cost += process_relations(*n1, n2, rc, 2, state, &count, &retained);
+	cost += process_relations(n2, credit, 2, state, &retained);
 #ifdef VERBOSE_COSTS_4
 	cout << "Costs after process_relations up: " << cost << endl;
 #endif
 
-	for (i3 = count->begin(); i3 != count->end(); i3++) {
-		int lcost = rc->modify(RelEqClass(i3->first,**n1), i3->second);
-		cost += lcost;
-	}
-	delete(count);
-
 #ifdef VERBOSE_COSTS
 	/* calc costs */
 	if (n2)
@@ -179,11 +338,16 @@ DiffDijkstra::makeState(const DiffDijkstraState* state, NodeVec::const_iterator
 		cout << "Cost for dropping " << **n1 << " is " << cost << endl;
 #endif
 
-	NodeAssignments* a = new NodeAssignments(*n1, n2, state->ass);
+	NodeAssignments* a = new (pool.alloc(sizeof(NodeAssignments))) NodeAssignments(*n1, n2, state->ass);
 
 	NodeVec::const_iterator ni = n1; ni++;
-	DiffDijkstraState* stat = new DiffDijkstraState(state->cost + cost,
-		state->length + (n2?1:0), state->retained + retained, ni, a, rc);
+	DiffDijkstraState* stat = new (pool.alloc(sizeof(DiffDijkstraState))) DiffDijkstraState(state->cost + cost,
+		state->length + (n2?1:0), state->retained + retained, ni, a, credit->commit(pool));
+	/* share the maps of the parent state, adding the new assignment */
+	stat->assigned1 = state->assigned1;
+	stat->assigned1.insert((*n1)->id, a);
+	stat->assigned2 = state->assigned2;
+	if (n2) stat->assigned2.insert(n2->id, a);
 
 	/* update best_retained value */
 	if (state->retained + retained > best_retained)
@@ -193,55 +357,182 @@ DiffDijkstra::makeState(const DiffDijkstraState* state, NodeVec::const_iterator
 	stat->seq = seq; seq++;
 #endif
 #ifdef TRACING_ENABLED
-	if (searchTreeOutputStream) {
-		if (n2)
-			*searchTreeOutputStream << "Add " << stat->seq << "," << **n1 << "," << *n2 << "," << stat->cost << "," << stat->retained << endl;
-		else
-			*searchTreeOutputStream << "Add " << stat->seq << "," << **n1 << ",," << stat->cost << "," << stat->retained << endl;
-	}
+	traceAdd(stat, *n1, n2);
 #endif
 	return stat;
 }
 
+int
+DiffDijkstra::score(const DiffDijkstraState* state, Node* n2, int* retained) {
+	*retained = 0;
+	int cost = process_relations(n2, credit, 1, state, retained);
+	cost += process_relations(n2, credit, 2, state, retained);
+	return cost;
+}
+
+int
+DiffDijkstra::estimate(const DiffDijkstraState* state) {
+	credit->moveTo(state->credit, pool);
+	prepareRelations(state);
+	int retained;
+	int best = score(state, NULL, &retained);
+	credit->rollback();
+	NodeVec& n = doc2->index_by_label[NodeEqClass(*(state->iter))];
+	for (NodeVec::iterator i = n.begin(); best && i != n.end(); i++) {
+		if (!*i || state->findNodeAssignment2(*i)) continue;
+		int cost = score(state, *i, &retained);
+		credit->rollback();
+		if (cost < best) best = cost;
+	}
+	return best;
+}
+
+/* ordering of the search queue; sorted stably, so that equally good
+ * states stay in the order they were made */
+static bool betterState(const DiffDijkstraState* a, const DiffDijkstraState* b) {
+	return *a < *b;
+}
+
+DiffDijkstraState*
+DiffDijkstra::beam(DiffDijkstraState* start) {
+	/* all states of a layer have matched or dropped the same nodes */
+	vector<DiffDijkstraState*> layer(1, start), next;
+	while (layer[0]->iter != nodevec.end()) {
+		for (vector<DiffDijkstraState*>::iterator s = layer.begin(); s != layer.end(); ++s) {
+#ifdef TRACING_ENABLED
+			traceStep(*s, layer.end() - s - 1);
+#endif
+			prepareRelations(*s);
+			NodeVec& n = doc2->index_by_label[NodeEqClass(*((*s)->iter))];
+			for (NodeVec::iterator i = n.begin(); i != n.end(); i++)
+				if (*i && !(*s)->findNodeAssignment2(*i))
+					next.push_back(makeState(*s, (*s)->iter, *i));
+			next.push_back(makeState(*s, (*s)->iter, NULL));
+			DiffDijkstraState::dispose(*s, pool);
+		}
+		/* keep the best ones */
+		stable_sort(next.begin(), next.end(), betterState);
+		for (size_t i = beamWidth; i < next.size(); i++)
+			DiffDijkstraState::dispose(next[i], pool);
+		if (next.size() > beamWidth) next.resize(beamWidth);
+		layer.swap(next);
+		next.clear();
+	}
+#ifdef TRACING_ENABLED
+	traceStep(layer[0], layer.size() - 1);
+#endif
+	for (size_t i = 1; i < layer.size(); i++)
+		DiffDijkstraState::dispose(layer[i], pool);
+	return layer[0];
+}
+
+DiffDijkstraState*
+DiffDijkstra::greedy(DiffDijkstraState* state) {
+	credit->moveTo(state->credit, pool);
+	while (true) {
+#ifdef TRACING_ENABLED
+		traceStep(state, 0);
+#endif
+		if (state->iter == nodevec.end()) return state;
+		Node* n1 = *(state->iter);
+		prepareRelations(state);
+
+		/* score the candidates in place, in the order the queue would
+		 * get them; the first of equally good ones wins */
+		NodeVec& n = doc2->index_by_label[NodeEqClass(n1)];
+		Node* best = NULL;
+		int bestCost = 0, bestRetained = 0;
+		bool any = false;
+		for (NodeVec::iterator i = n.begin(); i != n.end(); i++) {
+			if (!*i || state->findNodeAssignment2(*i)) continue;
+			int retained;
+			int cost = score(state, *i, &retained);
+			credit->rollback();
+			if (!any || cost < bestCost || (cost == bestCost && retained > bestRetained)) {
+				best = *i; bestCost = cost; bestRetained = retained; any = true;
+			}
+		}
+		/* dropping the node is shorter, so it has to be strictly better */
+		int retained;
+		int cost = score(state, NULL, &retained);
+		if (any && (cost > bestCost || (cost == bestCost && retained <= bestRetained))) {
+			credit->rollback();
+			cost = score(state, best, &retained);
+		} else
+			best = NULL;
+		/* keep the changes of the winner, this search never goes back */
+		credit->accept();
+
+		/* extend the state in place */
+		NodeAssignments* a = new (pool.alloc(sizeof(NodeAssignments))) NodeAssignments(n1, best, state->ass);
+		NodeAssignments::dispose(state->ass, pool);
+		state->ass = a;
+		state->assigned1.insert(n1->id, a);
+		if (best) state->assigned2.insert(best->id, a);
+		state->cost += cost;
+		state->retained += retained;
+		if (best) state->length++;
+		state->iter++;
+#ifdef VERBOSE_SEQCOUNT
+		state->seq = seq; seq++;
+#endif
+#ifdef TRACING_ENABLED
+		traceAdd(state, n1, best);
+#endif
+	}
+}
+
+/* a new state is not queued before the state it was made from; with
+ * estimated remaining costs its own costs may be lower than the
+ * priority of its parent, but the estimate still holds for it */
+static inline DiffDijkstraState* inherit(const DiffDijkstraState* parent, DiffDijkstraState* s) {
+	if (s->priority < parent->priority) s->priority = parent->priority;
+	return s;
+}
+
 bool
 DiffDijkstra::step() {
-	/* remove dead ends */
+	/* remove dead ends; the weighted search orders the queue by more
+	 * than the costs, so its dead ends are dropped when taken out */
 	int cutoff = max_retained - best_retained;
-	if ((*(worklist.rbegin()))->cost > cutoff) {
-		multiset<DiffDijkstraState*, DiffDijkstraStateQueue >::iterator wli;
-		wli = worklist.begin();
-		//cout << "Cutoff point: " << cutoff << ", current: " << (*wli)->cost << endl;
-		/* never delete the first, although this shouldn't happen anyway */
-		//wli++;
-		for (; wli != worklist.end(); ++wli)
-			if ((*wli)->cost > cutoff) {
-				//cout << "deleting states that can only do worse..." << endl;
-				worklist.erase(wli, worklist.end());
-				break;
-			}
-	}
+	/* nothing reaching the costs of the incumbent can improve on it */
+	if (incumbent && incumbent->cost - 1 < cutoff)
+		cutoff = incumbent->cost - 1;
+	if (!weight && worklist.maxCost() > cutoff)
+		worklist.prune(cutoff);
 
 	if (worklist.empty()) {
+		/* all pruned against the incumbent, which is the result then */
+		if (incumbent) return false;
 		throw "Worklist is empty. Somehow I lost my last state...";
 		return false;
 	}
 
 	/* retrieve the current entry in the work list */
-	DiffDijkstraState* current = *(worklist.begin());
-	worklist.erase(worklist.begin());
-#ifdef TRACING_ENABLED
-	if (searchTreeOutputStream) {
-		*searchTreeOutputStream << "Step " << ++steps << ": "
-			<< current->seq << "/" << seq << " (of " << worklist.size()+1
-			<< ") cost " << current->cost
-			<< ", retained " << current->retained
-			<< ", len " << current->length << " ";
-		if (current->ass && current->ass->n1)
-			*searchTreeOutputStream << *(current->ass->n1);
-		if (current->ass && current->ass->n2)
-			*searchTreeOutputStream << ", " << *(current->ass->n2);
-		*searchTreeOutputStream << endl;
+	DiffDijkstraState* current = worklist.pop();
+	if (weight && current->cost > cutoff) {
+		DiffDijkstraState::dispose(current, pool);
+		return true;
+	}
+
+	/* estimate the remaining costs only for states about to be expanded,
+	 * and queue them again if that puts them behind others */
+	if (weight && !current->estimated && current->iter != nodevec.end()) {
+		current->estimated = true;
+		/* priorities are bucket indexes, so large weights are saturated
+		 * one above any costs; this keeps them below weight times the
+		 * exact costs, so the result is still within the weight */
+		int h = estimate(current);
+		double w = h ? current->cost + weight * h : current->cost;
+		int p = (w > max_retained + 1) ? max_retained + 1 : (int) w;
+		if (p > current->priority) {
+			current->priority = p;
+			worklist.push(current);
+			return true;
+		}
 	}
+#ifdef TRACING_ENABLED
+	traceStep(current, worklist.size());
 #endif
 
 	if (current->iter == nodevec.end()) {
@@ -253,75 +544,570 @@ DiffDijkstra::step() {
 		NodeVec* n = &(doc2->index_by_label[cp]);
 
 		/* add yet unmatched nodes to worklist as new steps */
+		prepareRelations(current);
 		for (NodeVec::iterator i = n->begin(); i != n->end(); i++)
 			if (*i && !current->findNodeAssignment2(*i))
-				worklist.insert(makeState(current,current->iter, *i));
-		worklist.insert(makeState(current,current->iter, NULL));
+				worklist.push(inherit(current, makeState(current,current->iter, *i)));
+		worklist.push(inherit(current, makeState(current,current->iter, NULL)));
+		if (queueLimit && worklist.size() > queueLimit)
+			worklist.evict(queueLimit - queueLimit / EVICT_SHARE);
 		/* delete current state */
-		delete current;
+		DiffDijkstraState::dispose(current, pool);
 		return true;
 	}
 }
 
+/* wall clock time in seconds */
+static double seconds() {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec + now.tv_usec / 1e6;
+}
+
+void
+DiffDijkstra::startClock() {
+	started = seconds();
+}
+
+bool
+DiffDijkstra::provenBest(int cost) const {
+	return worklist.evictedPriority() < 0 || cost <= worklist.evictedPriority();
+}
+
+/* a copy of a state, sharing its assignments and credits */
+static DiffDijkstraState* copyState(const DiffDijkstraState* s, MemoryPool& pool) {
+	if (s->ass) REF_INC(s->ass->refcount);
+	if (s->credit) REF_INC(s->credit->refcount);
+	DiffDijkstraState* copy = new (pool.alloc(sizeof(DiffDijkstraState)))
+		DiffDijkstraState(s->cost, s->length, s->retained, s->iter, s->ass, s->credit);
+	copy->assigned1 = s->assigned1;
+	copy->assigned2 = s->assigned2;
+	copy->complete = s->complete;
+	return copy;
+}
+
+DiffDijkstraState*
+DiffDijkstra::anytime(DiffDijkstraState* start) {
+	double stop = (started ? started : seconds()) + deadline;
+
+	/* the greedy search changes its state and the credits in place, so it
+	 * gets a copy of both, the credits starting from the initial values */
+	credit->moveTo(NULL, pool);
+	RelCount* shared = credit;
+	credit = new RelCount(*shared);
+	incumbent = greedy(copyState(start, pool));
+	credit->moveTo(NULL, pool);
+	delete credit;
+	credit = shared;
+
+	/* improve on it with the exact search while there is time */
+	worklist.push(start);
+	bool finished = false;
+	while (!finished && seconds() < stop)
+		finished = !step();
+
+	DiffDijkstraState* best = incumbent;
+	incumbent = NULL;
+	if (result) {
+		/* only states better than the incumbent are completed */
+		DiffDijkstraState::dispose(best, pool);
+		best = result;
+		result = NULL;
+		optimal = provenBest(best->cost);
+	} else
+		/* nothing left or still waiting can do better */
+		optimal = provenBest(best->cost) && (finished || worklist.empty()
+			|| best->cost <= worklist.minPriority());
+	/* the pool is reset after the search */
+	worklist.abandon();
+	return best;
+}
+
+/** \brief order of the states of a cost for the search in one thread
+ *
+ *  as in the queue: most retained relations first, then the longest;
+ *  states still equal in that are queued in the order they were made,
+ *  which here is approximated by the candidates chosen: at the first
+ *  node where they differ, the earlier candidate first, dropping last. */
+struct QueueOrder {
+	/** \brief start of the nodes to be matched */
+	NodeVec::const_iterator	begin;
+
+	/** \brief compare two states
+	 *  \param a first state
+	 *  \param b second state
+	 *  \return if a is queued before b */
+	bool operator()(const DiffDijkstraState* a, const DiffDijkstraState* b) const {
+		if (a->retained != b->retained) return a->retained > b->retained;
+		if (a->length != b->length) return a->length > b->length;
+		/* a state has one assignment per node before its position */
+		int ka = a->iter - begin, kb = b->iter - begin;
+		const NodeAssignments* pa = a->ass;
+		const NodeAssignments* pb = b->ass;
+		for (int k = ka; k > kb; k--) pa = pa->next;
+		for (int k = kb; k > ka; k--) pb = pb->next;
+		/* up to the assignments they share */
+		const Node* mine = NULL;
+		const Node* theirs = NULL;
+		bool differ = false;
+		for (; pa != pb; pa = pa->next, pb = pb->next)
+			if (pa->n2 != pb->n2) {
+				mine = pa->n2;
+				theirs = pb->n2;
+				differ = true;
+			}
+		if (!differ) return ka < kb;
+		return theirs ? (mine && mine->id < theirs->id) : (mine != NULL);
+	}
+};
+
+DiffDijkstraState*
+DiffDijkstra::parallel(DiffDijkstraState* start) {
+	ParallelSearch* ps = new ParallelSearch();
+	shared = ps;
+	ps->threads = threads;
+	ps->inbox.resize(threads);
+	for (unsigned int t = 0; t < threads; t++) {
+		ps->inbox[t].head = NULL;
+		ps->inbox[t].idle = false;
+	}
+	ps->pending = 0;
+	ps->bestRetained = best_retained;
+	ps->nextLevel = INT_MAX;
+	ps->final = false;
+	ps->go = false;
+	ps->stop = false;
+	ps->error = NULL;
+	ps->end = nodevec.end();
+
+	/* the other threads start from the initial credits */
+	credit->moveTo(NULL, pool);
+	ps->workers.assign(threads, this);
+	for (unsigned int t = 1; t < threads; t++)
+		ps->workers[t] = new DiffDijkstra(*this, ps, t);
+
+	/* the states are shared by the threads that could be started */
+	vector<pthread_t> thread(threads);
+	unsigned int started = 1;
+	while (started < threads && pthread_create(&thread[started], NULL, runWorker, ps->workers[started]) == 0)
+		started++;
+	ps->threads = started;
+	ps->barrier.init(started);
+	__atomic_store_n(&ps->go, true, __ATOMIC_RELEASE);
+
+	worklist.push(start);
+	runWorker(this);
+	for (unsigned int t = 1; t < started; t++)
+		pthread_join(thread[t], NULL);
+	ps->barrier.destroy();
+
+	/* the memory of all threads is dropped with the pools, see run() */
+	vector<DiffDijkstraState*> states;
+	for (unsigned int t = 0; t < ps->workers.size(); t++) {
+		DiffDijkstra* w = ps->workers[t];
+		w->worklist.abandon();
+		states.insert(states.end(), w->levelStart.begin(), w->levelStart.end());
+		w->levelStart.clear();
+		if (t) {
+			w->credit->moveTo(NULL, w->pool);
+			delete w->credit;
+			w->credit = NULL;
+		}
+	}
+	if (ps->error) throw ps->error;
+	if (!ps->final) throw "Worklist is empty. Somehow I lost my last state...";
+
+	/* the states of the lowest costs with a result are searched in this
+	 * thread, in the order the search in one thread would take them */
+	QueueOrder order = { nodevec.begin() };
+	sort(states.begin(), states.end(), order);
+	for (vector<DiffDijkstraState*>::iterator i = states.begin(); i != states.end(); ++i)
+		worklist.push(*i);
+	best_retained = ps->bestRetained;
+	while (step()) {;};
+	DiffDijkstraState* best = result;
+	result = NULL;
+	worklist.abandon();
+	optimal = true;
+	return best;
+}
+
+void*
+DiffDijkstra::runWorker(void* arg) {
+	DiffDijkstra* d = (DiffDijkstra*) arg;
+	ParallelSearch& ps = *d->shared;
+	try {
+		d->work();
+	} catch (const char* e) {
+		/* keep the first error, and release the threads waiting for this one */
+		const char* none = NULL;
+		__atomic_compare_exchange_n(&ps.error, &none, e, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+		__atomic_store_n(&ps.stop, true, __ATOMIC_RELEASE);
+		ps.barrier.abort();
+	}
+	return NULL;
+}
+
+void
+DiffDijkstra::work() {
+	ParallelSearch& ps = *shared;
+	while (!__atomic_load_n(&ps.go, __ATOMIC_ACQUIRE)) sched_yield();
+	AssignmentMap::usePool(&pool);
+
+	for (;;) {
+		/* no thread is searching now, and no state is sent */
+		receive();
+		if (ps.bestRetained > best_retained) best_retained = ps.bestRetained;
+		/* remove dead ends */
+		worklist.prune(max_retained - best_retained);
+		int low = worklist.empty() ? INT_MAX : worklist.minPriority();
+		int next = __atomic_load_n(&ps.nextLevel, __ATOMIC_RELAXED);
+		while (low < next && !__atomic_compare_exchange_n(&ps.nextLevel, &next, low,
+				false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+		if (!ps.barrier.wait()) break;
+
+		/* all threads search the states of the lowest costs queued; the
+		 * ones they start from are kept, in case a result is found */
+		int level = ps.nextLevel;
+		if (level == INT_MAX) break;
+		vector<DiffDijkstraState*> states;
+		while (!worklist.empty() && worklist.minPriority() == level)
+			states.push_back(worklist.pop());
+		for (vector<DiffDijkstraState*>::iterator i = states.begin(); i != states.end(); ++i) {
+			levelStart.push_back(copyState(*i, pool));
+			worklist.push(*i);
+		}
+		__atomic_add_fetch(&ps.pending, states.size(), __ATOMIC_ACQ_REL);
+		__atomic_store_n(&ps.inbox[worker].idle, false, __ATOMIC_RELAXED);
+		if (!ps.barrier.wait()) break;
+		if (!worker) ps.nextLevel = INT_MAX;
+
+		search(level);
+		if (!ps.barrier.wait()) break;
+		if (ps.final) break;
+		for (vector<DiffDijkstraState*>::iterator i = levelStart.begin(); i != levelStart.end(); ++i)
+			DiffDijkstraState::dispose(*i, pool);
+		levelStart.clear();
+	}
+	/* the main search keeps its pool until run() is done */
+	if (worker) AssignmentMap::usePool(NULL);
+}
+
+void
+DiffDijkstra::search(int level) {
+	ParallelSearch& ps = *shared;
+	Inbox& in = ps.inbox[worker];
+	while (!__atomic_load_n(&ps.final, __ATOMIC_ACQUIRE) && !__atomic_load_n(&ps.stop, __ATOMIC_ACQUIRE)) {
+		receive();
+		if (worklist.empty() || worklist.minPriority() != level) {
+			/* ask the others for states; done when no thread has
+			 * anything of these costs left */
+			if (!__atomic_load_n(&in.idle, __ATOMIC_RELAXED))
+				__atomic_store_n(&in.idle, true, __ATOMIC_RELEASE);
+			if (!__atomic_load_n(&ps.pending, __ATOMIC_ACQUIRE)) break;
+			sched_yield();
+			continue;
+		}
+
+		DiffDijkstraState* current = worklist.pop();
+		if (current->iter == ps.end) {
+			/* the search in one thread has a result of these costs, too */
+			__atomic_store_n(&ps.final, true, __ATOMIC_RELEASE);
+		} else {
+			/* the new states stay here, so each thread follows its best
+			 * states as the search in one thread does */
+			NodeVec& n = doc2->index_by_label[NodeEqClass(*(current->iter))];
+			prepareRelations(current);
+			long added = 0;
+			for (NodeVec::iterator i = n.begin(); i != n.end(); i++)
+				if (*i && !current->findNodeAssignment2(*i)) {
+					DiffDijkstraState* s = makeState(current, current->iter, *i);
+					if (s->cost == level) added++;
+					worklist.push(s);
+				}
+			DiffDijkstraState* s = makeState(current, current->iter, NULL);
+			if (s->cost == level) added++;
+			worklist.push(s);
+			if (added) __atomic_add_fetch(&ps.pending, added, __ATOMIC_ACQ_REL);
+			/* share the best retained value */
+			int b = __atomic_load_n(&ps.bestRetained, __ATOMIC_RELAXED);
+			while (best_retained > b && !__atomic_compare_exchange_n(&ps.bestRetained, &b, best_retained,
+					false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+			share(level);
+		}
+		DiffDijkstraState::dispose(current, pool);
+		__atomic_sub_fetch(&ps.pending, 1, __ATOMIC_ACQ_REL);
+	}
+}
+
+void
+DiffDijkstra::share(int level) {
+	ParallelSearch& ps = *shared;
+	for (unsigned int t = 0; t < ps.threads; t++) {
+		if (t == worker || !__atomic_load_n(&ps.inbox[t].idle, __ATOMIC_ACQUIRE)) continue;
+		/* the best state is kept, the next one of these costs given away */
+		if (worklist.empty() || worklist.minPriority() != level) return;
+		DiffDijkstraState* best = worklist.pop();
+		bool more = !worklist.empty() && worklist.minPriority() == level;
+		bool idle = true;
+		if (more && __atomic_compare_exchange_n(&ps.inbox[t].idle, &idle, false,
+				false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+			send(worklist.pop(), t);
+		worklist.push(best);
+		if (!more) return;
+	}
+}
+
+void
+DiffDijkstra::send(DiffDijkstraState* s, unsigned int to) {
+	ParallelSearch& ps = *shared;
+	StateMessage* m = (StateMessage*) pool.alloc(sizeof(StateMessage));
+	m->state = s;
+	m->next = __atomic_load_n(&ps.inbox[to].head, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&ps.inbox[to].head, &m->next, m,
+			false, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+void
+DiffDijkstra::receive() {
+	Inbox& in = shared->inbox[worker];
+	StateMessage* m = __atomic_exchange_n(&in.head, (StateMessage*) NULL, __ATOMIC_ACQUIRE);
+	while (m) {
+		StateMessage* next = m->next;
+		worklist.push(m->state);
+		pool.free(m, sizeof(StateMessage));
+		m = next;
+	}
+}
+
+void
+DiffDijkstra::dropWorkers() {
+	/* only the main search owns the others */
+	if (!shared || worker) return;
+	for (unsigned int t = 1; t < shared->workers.size(); t++)
+		delete shared->workers[t];
+	delete shared;
+	shared = NULL;
+}
+
+DiffDijkstraState*
+DiffDijkstra::detachState(DiffDijkstraState* s) {
+	/* copy the assignment list, keeping its order */
+	NodeAssignments* head = NULL;
+	NodeAssignments** tail = &head;
+	for (NodeAssignments* a = s->ass; a; a = a->next) {
+		*tail = new NodeAssignments(a->n1, a->n2, NULL);
+		tail = &((*tail)->next);
+	}
+	DiffDijkstraState* copy = new DiffDijkstraState(s->cost, s->length, s->retained, s->iter, head, NULL);
+	copy->complete = s->complete;
+#ifdef VERBOSE_SEQCOUNT
+	copy->seq = s->seq;
+#endif
+	DiffDijkstraState::dispose(s, pool);
+	return copy;
+}
+
+/* dense id of a node class, numbering new classes in order of appearance */
+static unsigned int classId(hashmap<uint64_t, unsigned int, hashfun<uint64_t> >& ids, Node* n) {
+	uint64_t key = NodeEqClass(n).key();
+	hashmap<uint64_t, unsigned int, hashfun<uint64_t> >::iterator f = ids.find(key);
+	if (f != ids.end()) return f->second;
+	unsigned int id = ids.size();
+	ids[key] = id;
+	return id;
+}
+
+void
+DiffDijkstra::numberClasses() {
+	hashmap<uint64_t, unsigned int, hashfun<uint64_t> > ids;
+	class1.resize(doc1->size());
+	for (unsigned int id = 0; id < doc1->size(); id++)
+		class1[id] = classId(ids, doc1->getNode(id));
+	class2.resize(doc2->size());
+	for (unsigned int id = 0; id < doc2->size(); id++)
+		class2[id] = classId(ids, doc2->getNode(id));
+	classCredits.assign(ids.size(), ClassCredit());
+	for (int dir = 0; dir < 2; dir++)
+		first[dir].expecting.assign(doc2->size(), false);
+	found.assign(doc2->size(), 0);
+}
+
+/* smallest subtree to be matched before the search. Smaller ones, such
+ * as an element with a single attribute or text, are left to the search,
+ * which can also consider matching their parts separately. */
+#define PREMATCH_MIN_NODES 3
+
+/** \brief occurrences of a subtree hash in both documents */
+struct SubtreeOccurrence {
+	/** \brief last subtree with this hash in the first document */
+	Node*		n1;
+	/** \brief last subtree with this hash in the second document */
+	Node*		n2;
+	/** \brief number of occurrences in the first document */
+	unsigned int	c1;
+	/** \brief number of occurrences in the second document */
+	unsigned int	c2;
+};
+
+bool
+DiffDijkstra::sameSubtree(const Node* n1, const Node* n2) const {
+	unsigned int size = n1->last - n1->id;
+	if (n2->last - n2->id != size) return false;
+	for (unsigned int k = 0; k <= size; k++) {
+		const Node* a = doc1->getNode(n1->id + k);
+		const Node* b = doc2->getNode(n2->id + k);
+		if (a->type != b->type || a->label != b->label || a->content != b->content)
+			return false;
+		/* same shape: parents at the same relative position */
+		if (k > 0 && a->parent->id - n1->id != b->parent->id - n2->id)
+			return false;
+	}
+	return true;
+}
+
+void
+DiffDijkstra::prematch(NodeVec& pre1, NodeVec& pre2) const {
+	hashmap<uint64_t, SubtreeOccurrence, hashfun<uint64_t> > occ;
+	for (NodeVec::const_iterator i = doc1->getNodesIter(); i != doc1->getNodesIterEnd(); ++i) {
+		SubtreeOccurrence& o = occ[(*i)->treehash];
+		o.n1 = *i;
+		o.c1++;
+	}
+	for (NodeVec::const_iterator i = doc2->getNodesIter(); i != doc2->getNodesIterEnd(); ++i) {
+		hashmap<uint64_t, SubtreeOccurrence, hashfun<uint64_t> >::iterator f = occ.find((*i)->treehash);
+		if (f == occ.end()) continue;
+		f->second.n2 = *i;
+		f->second.c2++;
+	}
+	/* in document order, so the largest subtrees are found first */
+	for (unsigned int id = 0; id < doc1->size(); ) {
+		Node* n1 = doc1->getNode(id);
+		const SubtreeOccurrence& o = occ[n1->treehash];
+		if (n1->last - n1->id + 1 < PREMATCH_MIN_NODES
+				|| o.c1 != 1 || o.c2 != 1 || !sameSubtree(n1, o.n2)) {
+			id++;
+			continue;
+		}
+		for (unsigned int k = 0; k <= n1->last - n1->id; k++) {
+			pre1.push_back(doc1->getNode(n1->id + k));
+			pre2.push_back(doc2->getNode(o.n2->id + k));
+		}
+		id = n1->last + 1;
+	}
+}
+
 bool
 DiffDijkstra::run() {
 	/* calculate the credits by using the relation count */
-	RelCount* credit = new RelCount(doc1->relcount, doc2->relcount);
+	credit = new RelCount(doc1->relcount, doc2->relcount);
+	AssignmentMap::usePool(&pool);
+	doc1->annotateRelations();
+	doc2->annotateRelations();
+	numberClasses();
 	max_retained = 2*RelCount::calc_max_retained(doc1->relcount, doc2->relcount);
 	//cout << "Max retained: " << max_retained << endl;
 	//cerr << *credit << endl;
 
+	/* identical subtrees are matched up front, their nodes come first */
+	NodeVec pre1, pre2;
+	if (prematchSubtrees) prematch(pre1, pre2);
+	vector<bool> prematched(doc1->size(), false);
+	nodevec.clear();
+	for (NodeVec::iterator i = pre1.begin(); i != pre1.end(); ++i) {
+		prematched[(*i)->id] = true;
+		nodevec.push_back(*i);
+	}
+
 	/* sort nodes by occurrence, low occurrence comes first */
 	/* this small trick showed a 3* improvement in the first test - 84 steps instead of 224 */
 	if (1) {
 		multimap< int, Node* > nsort;
 
 		for (NodeVec::const_iterator i=doc1->getNodesIter(); i != doc1->getNodesIterEnd(); ++i) {
+			if (prematched[(*i)->id]) continue;
 			int count = doc2->index_by_label[NodeEqClass(*i)].size();
 			nsort.insert(pair<int, Node*>(count, *i));
 		}
 
-		nodevec.empty();
 		for (multimap< int, Node*>::iterator i = nsort.begin(); i != nsort.end(); ++i) {
 			nodevec.push_back(i->second);
 		}
-		nsort.empty();
 	} else {
 		/* just copy the first list. its private, so we can't copy it directly */
 		for (NodeVec::const_iterator i=doc1->getNodesIter(); i != doc1->getNodesIterEnd(); ++i)
-			nodevec.push_back(*i);
+			if (!prematched[(*i)->id]) nodevec.push_back(*i);
 	}
 
-	if (fastApproximativeMode) {
-		/* make start state with credits */
-		worklist.insert(new DiffDijkstraState(0,0,0,nodevec.begin(),NULL, credit));
-		while (step()) {
-			/* drop all other states except the first */
-			multiset<DiffDijkstraState*, DiffDijkstraStateQueue >::iterator wi = worklist.begin();
-			++wi;
-			worklist.erase(wi, worklist.end());
-		}
-		/* drop any remaining element in the work queue */
-		while (worklist.begin() != worklist.end()) {
-			delete *(worklist.begin());
-			worklist.erase(worklist.begin());
-		}
+	/* start state, with the pre-matched nodes already assigned */
+	DiffDijkstraState* start = new (pool.alloc(sizeof(DiffDijkstraState)))
+		DiffDijkstraState(0,0,0,nodevec.begin(),NULL, NULL);
+	for (NodeVec::iterator i = pre2.begin(); i != pre2.end(); ++i) {
+		prepareRelations(start);
+		DiffDijkstraState* next = makeState(start, start->iter, *i);
+		DiffDijkstraState::dispose(start, pool);
+		start = next;
+	}
+
+	if (beamWidth) {
+		result = beam(start);
+	} else if (fastApproximativeMode) {
+		result = greedy(start);
+	} else if (threads > 1 && !weight && !queueLimit && !deadline) {
+		result = parallel(start);
+	} else if (deadline) {
+		result = anytime(start);
 	} else {
-		/* start with the root node, node matched nodes yet */
-		worklist.insert(new DiffDijkstraState(0,0,0,nodevec.begin(),NULL, credit));
+		worklist.push(start);
 		/* process next element while not finished */
 		while (step()) {;};
-		/* drop any remaining element in the work queue */
-		while (worklist.begin() != worklist.end()) {
-			delete *(worklist.begin());
-			worklist.erase(worklist.begin());
-		}
+		/* evicted states could only have led to results with at least
+		 * their priority */
+		optimal = provenBest(result->cost);
+		/* drop any remaining element in the work queue, along with
+		 * the pool after the search */
+		worklist.abandon();
 	}
+	/* keep only the result, and drop all search memory at once */
+	if (result) result = detachState(result);
+	credit->moveTo(NULL, pool);
+	delete credit;
+	credit = NULL;
+	pool.reset();
+	AssignmentMap::usePool(NULL);
+	/* the pools of the other threads are released only now, as the
+	 * result and the credits could use their memory */
+	dropWorkers();
 	/* return "done" */
 	return false;
 }
 
 #ifdef TRACING_ENABLED
+void
+DiffDijkstra::traceStep(const DiffDijkstraState* s, size_t queued) {
+	/* the threads of a parallel search are not traced */
+	if (!searchTreeOutputStream || shared) return;
+	*searchTreeOutputStream << "Step " << ++steps << ": "
+		<< s->seq << "/" << seq << " (of " << queued+1
+		<< ") cost " << s->cost
+		<< ", retained " << s->retained
+		<< ", len " << s->length << " ";
+	if (s->ass && s->ass->n1)
+		*searchTreeOutputStream << *(s->ass->n1);
+	if (s->ass && s->ass->n2)
+		*searchTreeOutputStream << ", " << *(s->ass->n2);
+	*searchTreeOutputStream << endl;
+}
+
+void
+DiffDijkstra::traceAdd(const DiffDijkstraState* s, Node* n1, Node* n2) {
+	if (!searchTreeOutputStream || shared) return;
+	if (n2)
+		*searchTreeOutputStream << "Add " << s->seq << "," << *n1 << "," << *n2 << "," << s->cost << "," << s->retained << endl;
+	else
+		*searchTreeOutputStream << "Add " << s->seq << "," << *n1 << ",," << s->cost << "," << s->retained << endl;
+}
+
 /* setup and open the output stream for search tree dumping */
 void DiffDijkstra::setSearchTreeOutput(char* filename) {
 	if (searchTreeOutputStream) delete(searchTreeOutputStream);
@@ -336,15 +1122,121 @@ void DiffDijkstra::setSearchTreeOutput(char* filename) {
 std::ofstream* DiffDijkstra::searchTreeOutputStream = NULL;
 #endif
 
+void
+DiffDijkstraQueue::push(DiffDijkstraState* s) {
+#ifdef CAREFUL
+	if (s->priority < 0)
+		throw "DiffDijkstraQueue::push - negative priority";
+#endif
+	if (buckets.size() <= (unsigned int) s->priority)
+		buckets.resize(s->priority + 1);
+	/* states from other threads of a parallel search can be behind */
+	if ((unsigned int) s->priority < first)
+		first = s->priority;
+	Entry e;
+	e.retained = s->retained;
+	e.length = s->length;
+	e.order = order++;
+	e.state = s;
+	vector<Entry>& b = buckets[s->priority];
+	b.push_back(e);
+	push_heap(b.begin(), b.end());
+	count++;
+}
+
+DiffDijkstraState*
+DiffDijkstraQueue::pop() {
+	if (!count) return NULL;
+	while (buckets[first].empty()) {
+		/* never used again, the priority only grows */
+		vector<Entry>().swap(buckets[first]);
+		first++;
+	}
+	vector<Entry>& b = buckets[first];
+	pop_heap(b.begin(), b.end());
+	DiffDijkstraState* s = b.back().state;
+	b.pop_back();
+	count--;
+	/* keep maxCost() valid */
+	while (!buckets.empty() && buckets.back().empty() && buckets.size() > first + 1)
+		buckets.pop_back();
+	return s;
+}
+
+void
+DiffDijkstraQueue::dropBucket(unsigned int b) {
+	for (vector<Entry>::iterator i = buckets[b].begin(); i != buckets[b].end(); ++i)
+		DiffDijkstraState::dispose(i->state, pool);
+	count -= buckets[b].size();
+	vector<Entry>().swap(buckets[b]);
+}
+
+void
+DiffDijkstraQueue::prune(int cutoff) {
+	unsigned int keep = (cutoff < 0) ? 0 : cutoff + 1;
+	while (buckets.size() > keep) {
+		dropBucket(buckets.size() - 1);
+		buckets.pop_back();
+	}
+	while (!buckets.empty() && buckets.back().empty())
+		buckets.pop_back();
+}
+
+void
+DiffDijkstraQueue::evict(size_t keep) {
+	while (count > keep) {
+		unsigned int b = buckets.size() - 1;
+		vector<Entry>& v = buckets[b];
+		size_t n = count - keep;
+		if (!v.empty() && (evictedMin < 0 || b < (unsigned int) evictedMin))
+			evictedMin = b;
+		if (v.size() <= n) {
+			evicted += v.size();
+			dropBucket(b);
+			buckets.pop_back();
+			continue;
+		}
+		/* sorted, the worst states come first */
+		sort_heap(v.begin(), v.end());
+		for (size_t i = 0; i < n; i++)
+			DiffDijkstraState::dispose(v[i].state, pool);
+		v.erase(v.begin(), v.begin() + n);
+		make_heap(v.begin(), v.end());
+		count -= n;
+		evicted += n;
+	}
+}
+
+int
+DiffDijkstraQueue::minPriority() const {
+	if (!count) return -1;
+	unsigned int b = first;
+	while (buckets[b].empty()) b++;
+	return b;
+}
+
+void
+DiffDijkstraQueue::abandon() {
+	buckets.clear();
+	count = 0;
+}
+
+void
+DiffDijkstraQueue::clear() {
+	for (unsigned int b = first; b < buckets.size(); b++)
+		dropBucket(b);
+	buckets.clear();
+	count = 0;
+}
+
 NodeAssignments::NodeAssignments(Node* nn1, Node* nn2, NodeAssignments* nnext)
 	: n1(nn1), n2(nn2), next(nnext), refcount(1) {
-	if (next) { next->refcount++; }
+	if (next) { REF_INC(next->refcount); }
 }
 
 /* release and destroy if needed */
 bool NodeAssignments::release() {
-	refcount--;
-	return (refcount == 0);
+	return (REF_DEC(refcount) == 0);
 }
 
 NodeAssignments::~NodeAssignments() {
@@ -357,22 +1249,32 @@ NodeAssignments::~NodeAssignments() {
 	}
 }
 
-const NodeAssignments* DiffDijkstraState::findNodeAssignment1(Node* n1) const {
-	NodeAssignments* iter = ass;
-	while(iter) {
-		if (iter->n1 == n1) return iter;
-		iter = iter->next;
+void NodeAssignments::dispose(NodeAssignments* a, MemoryPool& pool) {
+	while (a && a->release()) {
+		NodeAssignments* next = a->next;
+		/* the next element is released here, not by the destructor */
+		a->next = NULL;
+		a->~NodeAssignments();
+		pool.free(a, sizeof(NodeAssignments));
+		a = next;
 	}
-	return NULL;
+}
+
+void DiffDijkstraState::dispose(DiffDijkstraState* s, MemoryPool& pool) {
+	NodeAssignments::dispose(s->ass, pool);
+	s->ass = NULL;
+	RelCountDelta::release(s->credit, pool);
+	s->credit = NULL;
+	s->~DiffDijkstraState();
+	pool.free(s, sizeof(DiffDijkstraState));
+}
+
+const NodeAssignments* DiffDijkstraState::findNodeAssignment1(Node* n1) const {
+	return assigned1.find(n1->id);
 }
 
 const NodeAssignments* DiffDijkstraState::findNodeAssignment2(Node* n2) const {
-	NodeAssignments* iter = ass;
-	while(iter) {
-		if (iter->n2 == n2) return iter;
-		iter = iter->next;
-	}
-	return NULL;
+	return assigned2.find(n2->id);
 }
 
 }
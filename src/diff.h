@@ -13,6 +13,8 @@
 #define SSD_DIFF_H
 #include "node.h"
 #include "doc.h"
+#include "assignment_map.h"
+#include "pool.h"
 #include <vector>
 #include <map>
 #include <set>
@@ -73,10 +75,59 @@ public:
 	/** \brief release and return if needed to be destroyed
 	 *  \return true when the object should be deleted now */
 	bool release();
+	/** \brief release a list element made from pooled memory
+	 *
+	 *  elements no longer referred to are destroyed and returned to the pool,
+	 *  walking up the list iteratively.
+	 *  \param a list element, may be NULL
+	 *  \param pool pool the list elements were taken from */
+	static void dispose(NodeAssignments* a, MemoryPool& pool);
 	/** \brief destructor */
 	~NodeAssignments();
 };
 
+/** \brief local credits of one class of related nodes */
+struct ClassCredit {
+	/** \brief related nodes in the first document minus those in the second */
+	int		count;
+	/** \brief RelCount slot of the relations to this class */
+	unsigned int	slot;
+	/** \brief no nodes yet */
+	ClassCredit() : count(0), slot(RELCOUNT_UNIQUE) {};
+};
+
+/** \brief relation to a node of the second document a new match should retain */
+struct ExpectedRelation {
+	/** \brief node in the second document */
+	Node*		n2;
+	/** \brief RelCount slot of the relation */
+	unsigned int	slot;
+};
+
+/** \brief local credits of one class of nodes related in the first document */
+struct ClassCount {
+	/** \brief dense class id */
+	unsigned int	cls;
+	/** \brief number of related, still unmatched nodes of the class */
+	int		count;
+	/** \brief RelCount slot of the relations to this class */
+	unsigned int	slot;
+};
+
+/** \brief relations of a node of the first document in one direction
+ *
+ *  they only depend on the state being expanded and the node being
+ *  matched, so they are collected once per expansion and shared by all
+ *  candidates, see DiffDijkstra::prepareRelations(). */
+struct FirstRelations {
+	/** \brief relations to matched nodes, by the partner of the related node */
+	vector<ExpectedRelation>	expected;
+	/** \brief relations to unmatched nodes, by class */
+	vector<ClassCount>		unmatched;
+	/** \brief set for the nodes of the second document in expected, by node id */
+	vector<bool>			expecting;
+};
+
 /** \brief state object for the Dijkstra search we are implementing */
 /** Each open end in the Dijkstra Search is represented by such an object.
  *  By keeping a reference to the "node assignment", it will keep the
@@ -89,6 +140,12 @@ public:
 #endif
 	/** \brief current costs of this state, needed for sorting */
 	int cost;
+	/** \brief position in the search queue, see DiffDijkstra::weight */
+	/** the costs, unless the weighted search added an estimate of the
+	 *  remaining costs */
+	int priority;
+	/** \brief the remaining costs were estimated for the priority */
+	bool estimated;
 	/** \brief how many nodes have been matched */
 	int length;
 	/** \brief number of retained relations */
@@ -105,9 +162,13 @@ public:
 	NodeVec::const_iterator iter;
 	/** \brief Assignments made for the current state */
 	NodeAssignments* ass;
+	/** \brief Assignments by id of the node in the first document */
+	AssignmentMap assigned1;
+	/** \brief Assignments by id of the node in the second document */
+	AssignmentMap assigned2;
 
-	/** \brief current "credits" for this search state */
-	RelCount* credit;
+	/** \brief current "credits" for this search state, as changes along the search path */
+	RelCountDelta* credit;
 
 	/** \brief constructor for a new state
 	 *
@@ -116,14 +177,19 @@ public:
 	 * \param p "iterator" to the next node to be processed
 	 * \param a list of node assignments with relcount already increased
 	 * \param cr remaining credits for this state */
-	DiffDijkstraState(int c, int l, int r, NodeVec::const_iterator p, NodeAssignments* a, RelCount* cr) :
+	DiffDijkstraState(int c, int l, int r, NodeVec::const_iterator p, NodeAssignments* a, RelCountDelta* cr) :
 #ifdef VERBOSE_SEQCOUNT
 		seq(0),
 #endif
-		cost(c), length(l), retained(r),
+		cost(c), priority(c), estimated(false), length(l), retained(r),
 		complete(false), iter(p), ass(a), credit(cr) {};
 	/** \brief Destructor that releases referenced data */
-	~DiffDijkstraState() { if (ass && ass->release()) delete(ass); if (credit) delete(credit); }
+	/** credits are pooled, see dispose() */
+	~DiffDijkstraState() { if (ass && ass->release()) delete(ass); }
+	/** \brief destroy a state made from pooled memory
+	 *  \param s state to be destroyed
+	 *  \param pool pool the state, its credits and assignments were taken from */
+	static void dispose(DiffDijkstraState* s, MemoryPool& pool);
 	/** \brief test if node n1 is assigned in the current state */
 	/** \param n1 the node to be found
 	 *  \return the node assignment if found */
@@ -146,16 +212,105 @@ public:
 	};
 };
 
-/** \brief sorting function used for sorting the state queue */
-/** just using the ordering given by the states themselves */
-struct DiffDijkstraStateQueue {
-	/** \brief sorting function used for sorting the state queue */
-	/** just using the ordering given by the states themselves */
-	bool operator()(const DiffDijkstraState* s1, const DiffDijkstraState* s2) const {
-		return *s1 < *s2;
-	}
+/** \brief priority queue of search states
+ *
+ *  States are kept in buckets by their (small, non-negative) priority,
+ *  which are their costs unless the weighted search is used. As the
+ *  priority of new states never falls below the priority of the state
+ *  they were made from, the lowest non-empty bucket mostly moves upwards;
+ *  only states passed between the threads of a parallel search can be
+ *  added below it. Within a
+ *  bucket, a binary heap orders the states by retained relations and
+ *  length (see DiffDijkstraState::operator<), and states that are still
+ *  equal in order of insertion.
+ *
+ *  The queue owns the states in it; removing states by prune() or
+ *  clear() destroys them, returning their memory to the pool. */
+class DiffDijkstraQueue {
+private:
+	/** \brief heap entry, the sort keys are copied for locality */
+	struct Entry {
+		/** \brief retained relations of the state */
+		int	retained;
+		/** \brief length of the state */
+		int	length;
+		/** \brief insertion counter, for ties */
+		unsigned long	order;
+		/** \brief the state */
+		DiffDijkstraState*	state;
+		/** \brief heap order: true if this entry comes after the other */
+		bool operator<(const Entry& other) const {
+			return (retained != other.retained) ? (retained < other.retained) :
+			  (length != other.length) ? (length < other.length) :
+			  (order > other.order);
+		}
+	};
+	/** \brief heaps of states, indexed by cost */
+	vector<vector<Entry> >	buckets;
+	/** \brief lowest bucket that may be non-empty */
+	unsigned int	first;
+	/** \brief number of states in the queue */
+	size_t		count;
+	/** \brief insertion counter */
+	unsigned long	order;
+	/** \brief number of states evicted */
+	size_t		evicted;
+	/** \brief lowest priority of the states evicted, -1 if none */
+	int		evictedMin;
+	/** \brief pool the states are taken from */
+	MemoryPool&	pool;
+	/** \brief no copying, the queue owns the states */
+	DiffDijkstraQueue(const DiffDijkstraQueue&);
+	/** \brief no copying, the queue owns the states */
+	DiffDijkstraQueue& operator=(const DiffDijkstraQueue&);
+	/** \brief destroy the states of a bucket and release its memory
+	 *  \param b bucket index */
+	void dropBucket(unsigned int b);
+public:
+	/** \brief make an empty queue
+	 *  \param p pool the states are taken from */
+	DiffDijkstraQueue(MemoryPool& p) : first(0), count(0), order(0), evicted(0), evictedMin(-1), pool(p) {};
+	/** \brief destructor, destroying all remaining states */
+	~DiffDijkstraQueue() { clear(); }
+	/** \brief add a state
+	 *  \param s state */
+	void push(DiffDijkstraState* s);
+	/** \brief take the best state out of the queue
+	 *  \return best state, now owned by the caller */
+	DiffDijkstraState* pop();
+	/** \brief test for an empty queue */
+	bool empty() const { return count == 0; }
+	/** \brief number of states in the queue */
+	size_t size() const { return count; }
+	/** \brief priority of the worst state in the queue, -1 if empty */
+	int maxCost() const { return count ? (int) buckets.size() - 1 : -1; }
+	/** \brief destroy all states with a priority above a limit
+	 *  \param cutoff highest priority to be kept */
+	void prune(int cutoff);
+	/** \brief destroy the worst states, keeping the best ones
+	 *
+	 *  unlike prune(), the states evicted might have led to a better
+	 *  result, so their lowest priority is kept, see evictedPriority().
+	 *  \param keep number of states to be kept */
+	void evict(size_t keep);
+	/** \brief number of states evicted so far */
+	size_t evictedStates() const { return evicted; }
+	/** \brief lowest priority of the states evicted so far, -1 if none */
+	int evictedPriority() const { return evictedMin; }
+	/** \brief priority of the best state in the queue, -1 if empty */
+	int minPriority() const;
+	/** \brief destroy all states */
+	void clear();
+	/** \brief forget all states without destroying them
+	 *
+	 *  much faster than clear() for a large queue, but only to be used
+	 *  when the pool the states were taken from is reset afterwards. */
+	void abandon();
 };
 
+/** \brief data shared by the threads of a parallel search, see DiffDijkstra::parallel() */
+struct ParallelSearch;
+
 /** \brief Dijkstra search core object */
 /** this object will control an Dijkstra search, managing the priority queue etc. */
 class DiffDijkstra : public Diff {
@@ -170,29 +325,219 @@ private:
 	int max_retained;
 	/** \brief number of steps done (i.e. nodes expanded) in the search */
 	int steps;
+	/** \brief memory for states, credits and node assignments of the search */
+	MemoryPool		pool;
+	/** \brief credit values, moved to the state being expanded */
+	RelCount*		credit;
 	/** \brief working queue */
-	multiset<DiffDijkstraState*, DiffDijkstraStateQueue >	worklist;
+	DiffDijkstraQueue	worklist;
 	/** \brief try to make one more step */
 	/** \return if successful or finished */
 	bool            	step();
 	/** \brief generate a new state object */
-	/** \param state the previous (parent) state object
-	 *  \param n1 the node in the first document newly matched
+	/** prepareRelations() must have been called for the parent state.
+	 *  \param state the previous (parent) state object
+	 *  \param n1 the node in the first document newly matched, state->iter
 	 *  \param n2 the node in the second document newly matched */
 	DiffDijkstraState* 	makeState(const DiffDijkstraState* state, NodeVec::const_iterator n1, Node* n2);
+	/** \brief costs of a match without keeping it
+	 *
+	 *  the changes to the credits are left for the caller to roll back
+	 *  or accept. prepareRelations() must have been called for the state.
+	 *  \param state the state to be extended
+	 *  \param n2 the node in the second document, NULL when dropping
+	 *  \param retained return parameter: number of retained relations
+	 *  \return costs caused */
+	int			score(const DiffDijkstraState* state, Node* n2, int* retained);
+	/** \brief lower bound of the remaining costs of a state
+	 *
+	 *  the costs of the cheapest match (or drop) of the next node, as
+	 *  every solution reached from the state makes one of them and costs
+	 *  never go down. Leaves the relations of the state prepared.
+	 *  \param state the state, not yet complete
+	 *  \return estimated remaining costs */
+	int			estimate(const DiffDijkstraState* state);
+	/** \brief beam search, keeping the best states of each depth
+	 *  \param start start state
+	 *  \return the best complete state found */
+	DiffDijkstraState*	beam(DiffDijkstraState* start);
+	/** \brief anytime search, improving on a greedy result until the deadline
+	 *
+	 *  the greedy result is kept as the incumbent, which the exact search
+	 *  only continues for states that can still do better. Sets optimal.
+	 *  \param start start state
+	 *  \return the best complete state found */
+	DiffDijkstraState*	anytime(DiffDijkstraState* start);
+	/** \brief wall clock time set by startClock(), 0 if not set */
+	static double		started;
+	/** \brief best complete state of the anytime search so far, NULL if none */
+	DiffDijkstraState*	incumbent;
+	/** \brief data shared with the other threads of a parallel search, NULL if none */
+	ParallelSearch*		shared;
+	/** \brief index of this search among the threads, 0 for the main one */
+	unsigned int		worker;
+	/** \brief copies of the states this thread had queued at the start of the costs searched */
+	vector<DiffDijkstraState*>	levelStart;
+	/** \brief make the search of another thread of a parallel search
+	 *
+	 *  it shares the documents and the node classes with the main search,
+	 *  and starts from the same initial credits.
+	 *  \param master the main search, its credits at the initial values
+	 *  \param ps data shared by the threads
+	 *  \param index index of the new search among the threads */
+	DiffDijkstra(DiffDijkstra& master, ParallelSearch* ps, unsigned int index);
+	/** \brief exact search on several threads
+	 *
+	 *  each thread has its own queue and keeps the states it makes,
+	 *  handing some to the threads that ran out of states. The threads
+	 *  expand all states of the lowest costs queued together, one cost
+	 *  after the other, until a complete state is found. The states of
+	 *  that cost are then searched again in this thread as the search
+	 *  without threads would, so the result is the same.
+	 *  \param start start state
+	 *  \return the best complete state */
+	DiffDijkstraState*	parallel(DiffDijkstraState* start);
+	/** \brief search loop of one thread of a parallel search */
+	void			work();
+	/** \brief expand the states of one cost, with the other threads
+	 *  \param level costs being searched */
+	void			search(int level);
+	/** \brief give states of the costs being searched to threads without any
+	 *  \param level costs being searched */
+	void			share(int level);
+	/** \brief queue a state at another thread
+	 *  \param s state, counted in ParallelSearch::pending if of the costs searched
+	 *  \param to index of the thread */
+	void			send(DiffDijkstraState* s, unsigned int to);
+	/** \brief queue the states other threads sent to this one */
+	void			receive();
+	/** \brief thread function of a parallel search
+	 *  \param arg the search of the thread
+	 *  \return NULL */
+	static void*		runWorker(void* arg);
+	/** \brief destroy the searches of the other threads, after the pool was reset */
+	void			dropWorkers();
+	/** \brief test if a result with given costs is the best one, as far as evictions go
+	 *  \param cost costs of the result
+	 *  \return false if an evicted state might have led to a better one */
+	bool			provenBest(int cost) const;
+	/** \brief greedy search for the fast mode
+	 *
+	 *  takes the best match for each node, in the order the search queue
+	 *  would pick it, and extends a single state in place. Only the
+	 *  winning candidate of each step is kept, so no states are made.
+	 *  \param state start state, changed into the result
+	 *  \return the result state */
+	DiffDijkstraState*	greedy(DiffDijkstraState* state);
+	/** \brief copy a pooled state to the heap, with its assignments
+	 *
+	 *  the copy has no credits and no assignment maps, it only carries
+	 *  the result for the output writers.
+	 *  \param s pooled state, destroyed
+	 *  \return heap copy of the state */
+	DiffDijkstraState*	detachState(DiffDijkstraState* s);
+	/** \brief collect the relations of the next node of a state in the first document
+	 *
+	 *  to be called before makeState() for a state; the result is used for
+	 *  all candidates until the next call.
+	 *  \param state the state to be expanded */
+	void			prepareRelations(const DiffDijkstraState* state);
+	/** \brief calculate the costs of the relations of a new match
+	 *
+	 *  uses the relations of the first document from prepareRelations()
+	 *  \param n2 the node in the second document, NULL when dropping n1
+	 *  \param rc credits to be updated
+	 *  \param dir 1 for "down" relations, 2 for "up" relations
+	 *  \param state the previous (parent) state object
+	 *  \param retained return parameter: incremented for each retained relation
+	 *  \return costs caused, including the expected loss for relations
+	 *  to still unmatched nodes */
+	int			process_relations(Node* n2, RelCount* rc, int dir,
+					const DiffDijkstraState* state, int* retained);
+	/** \brief number the node classes of both documents densely
+	 *
+	 *  sets up class1, class2 and the buffers of prepareRelations() and
+	 *  process_relations() */
+	void			numberClasses();
+
+	/** \brief dense class id of each node in the first document, by node id */
+	vector<unsigned int>	class1;
+	/** \brief dense class id of each node in the second document, by node id */
+	vector<unsigned int>	class2;
+	/** \brief relations of the node being matched, for "down" and "up" */
+	FirstRelations		first[2];
+	/** \brief scratch: local credits by class id, all zero between calls */
+	vector<ClassCredit>	classCredits;
+	/** \brief scratch: class ids whose local credits were changed */
+	vector<unsigned int>	touched;
+	/** \brief scratch: call of process_relations() in which a node of the
+	 *  second document was found to retain its relation, by node id */
+	vector<unsigned int>	found;
+	/** \brief number of the current call of process_relations() */
+	unsigned int		call;
 
 	/** \brief list of nodes from first document to be processed - will be resorted to optimize */
 	NodeVec nodevec;
 
+	/** \brief find identical subtrees occurring exactly once in both documents
+	 *
+	 *  only maximal subtrees are used, i.e. not those contained in another
+	 *  subtree found. The nodes of the subtrees are paired in document order.
+	 *  \param pre1 return parameter: nodes of the first document
+	 *  \param pre2 return parameter: corresponding nodes of the second document */
+	void prematch(NodeVec& pre1, NodeVec& pre2) const;
+	/** \brief compare two subtrees node by node
+	 *  \param n1 subtree root in the first document
+	 *  \param n2 subtree root in the second document
+	 *  \return true if the subtrees are identical */
+	bool sameSubtree(const Node* n1, const Node* n2) const;
+
 #ifdef TRACING_ENABLED
+	/** \brief trace an expanded state
+	 *  \param s state
+	 *  \param queued number of other states waiting */
+	void traceStep(const DiffDijkstraState* s, size_t queued);
+	/** \brief trace a new state
+	 *  \param s state
+	 *  \param n1 node in the first document matched
+	 *  \param n2 node in the second document matched, NULL if dropped */
+	void traceAdd(const DiffDijkstraState* s, Node* n1, Node* n2);
 	/** \brief debugging output stream */
 	static std::ofstream*	searchTreeOutputStream;
 #endif
 public:
 	/** \brief if fast-mode should be used */
 	static bool		fastApproximativeMode;
+	/** \brief number of states kept per depth by the beam search, 0 to not use it */
+	static unsigned int	beamWidth;
+	/** \brief weight of the estimated remaining costs in the search order, 0 to not use them
+	 *
+	 *  with a weight w >= 1 the search finds a result with at most w times
+	 *  the costs of the best one. */
+	static double		weight;
+	/** \brief most states kept in the queue of the search, 0 for no limit
+	 *
+	 *  beyond this the worst states are evicted, see DiffDijkstraQueue::evict() */
+	static size_t		queueLimit;
+	/** \brief number of threads for the exact search, 1 to not use threads */
+	static unsigned int	threads;
+	/** \brief seconds the exact search may take before the best result so far is used, 0 for no limit
+	 *
+	 *  counted from startClock(), or else from the start of the search. The
+	 *  greedy result is always completed, even past the deadline. */
+	static double		deadline;
+	/** \brief count the deadline from now, e.g. before loading the documents */
+	static void		startClock();
+	/** \brief if identical subtrees should be matched before the search */
+	static bool		prematchSubtrees;
 	/** \brief set to the result state object when finished */
 	DiffDijkstraState* 	result;
+	/** \brief set when finished if the result is known to have the lowest costs
+	 *
+	 *  or at most weight times those in the weighted search. Only the
+	 *  exact and the weighted search prove this, and only as long as no
+	 *  state that might have led to a better result was evicted. */
+	bool			optimal;
 	/** \brief constructor for the search */
 	/** \param eins first document to be compared
 	 *  \param zwei second document to be compared */
@@ -202,6 +547,8 @@ public:
 	/** \brief execute the search
 	 *  \return true if not yet finished */
 	bool run();
+	/** \brief number of states evicted to stay within queueLimit */
+	size_t evictedStates() const { return worklist.evictedStates(); }
 #ifdef TRACING_ENABLED
 	/** \brief for trace output */
 	static void setSearchTreeOutput(char* filename);
@@ -12,6 +12,9 @@
 #include "config.h"
 #include "doc.h"
 #include <iostream>
+#include <new>
+#include <cctype>
+#include <climits>
 
 #include <libxml/encoding.h>
 #include <libxml/xmlreader.h>
@@ -19,100 +22,507 @@
 #include <libxml/tree.h>
 
 #include <libxml/xpath.h>
+#include <libxml/parser.h>
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <unistd.h>
 
 namespace SSD {
 
 bool Doc::useWhitespace = false;
+unsigned int Doc::relationThreads = 0;
+
+/* minimum number of nodes per relation building thread */
+#define REL_MIN_NODES 4096
+
+/** \brief relations of a range of nodes, built by one thread */
+struct Doc::RelJob {
+	/** \brief document */
+	Doc*		doc;
+	/** \brief first node id of the range */
+	unsigned int	first;
+	/** \brief node id after the range */
+	unsigned int	end;
+	/** \brief relation axis */
+	RelationAxis	axis;
+	/** \brief XPath context of this thread, for AXIS_XPATH */
+	xmlXPathContextPtr	ctx;
+	/** \brief compiled XPath expression, for AXIS_XPATH */
+	xmlXPathCompExprPtr	xpath;
+	/** \brief relations of the range, ids relative to first */
+	RelGraph	part;
+	/** \brief relation counts of the range */
+	hashmap<RelEqClass, int, hash_releqc>	counts;
+	/** \brief error message, if any */
+	const char*	error;
+};
+
+/** \brief cache for names from the readers dictionary
+ *  names are unique within a dictionary, so the pointer value is enough */
+typedef hashmap<const xmlChar*, ustring, hashfun<const void*> > NameCache;
+
+/* unify a name, skipping the string hashing if we have seen the pointer */
+static ustring unifyName(NameCache& names, const xmlChar* name) {
+	NameCache::iterator iter = names.find(name);
+	if (iter != names.end()) return iter->second;
+	ustring u(name);
+	names.insert(make_pair(name, u));
+	return u;
+}
 
 /* clean the loaded document */
 void
 Doc::flushDoc() {
 	// clean the document
-	if (root) {
-		delete root; root=NULL;
-	}
+	/* all nodes and their lists are in the arena */
+	root = NULL;
+	arena.release();
 	if (dom) {
 		xmlFreeDoc(dom); dom=NULL;
 	}
 	nodes.clear();
+#ifdef NEED_INDEX
+	index_by_label.clear();
+#endif
+#ifdef NEED_PROCESSED_SET
+	processed.clear();
+#endif
+	xml_to_node.clear();
+	reldown.clear();
+	relup.clear();
+	relcount.clear();
 }
 
 void
-Doc::walkTreeXPath(xmlXPathContextPtr xpathctx, xmlXPathCompExprPtr xpath, Node* node) {
-#ifdef CAREFUL
-	if (!node) throw "Doc::walkTreeXPath called without a node";
-#endif
+Doc::walkTreeXPath(RelJob& job) {
+	for (unsigned int id = job.first; id < job.end; id++) {
+		Node* node = nodes[id];
+		job.ctx->node = (xmlNodePtr) node->data;
+		/* nodes are visited in document order, i.e. by increasing id */
+		job.part.startNode(id - job.first);
 
-	xpathctx->node = (xmlNodePtr) node->data;
-
-	xmlXPathObjectPtr xpathobj = xmlXPathCompiledEval( xpath, xpathctx );
-	if (!xpathobj) throw "Doc::walkTreeXPath: xmlXPathCompiledEval failed";
-	//if (!xpathobj->nodesetval) throw "Doc::walkTreeXPath: xmlXPathCompiledEval didn't return result";
-	if (xpathobj->nodesetval) {
-		if (xpathobj->nodesetval->nodeNr > 0)
-			if (!node->reldown) node->reldown = new NodeVec;
-		for (int i = 0; i < xpathobj->nodesetval->nodeNr; i++) {
-			xmlNodePtr cur = xpathobj->nodesetval->nodeTab[i];
-			/* find the corresponding Node in our data structure */
-			if (xml_to_node.find(cur) != xml_to_node.end()) {
-				Node* reln = xml_to_node[cur];
-				/* register node as related */
-				node->reldown->push_back(reln);
-				if (!reln->relup)
-					reln->relup = new NodeVec;
-				reln->relup->push_back(node);
-				/* do document relation count */
-				RelEqClass key(node, reln);
-				
-				hashmap<RelEqClass, int, hash_releqc>::iterator pos = relcount.find(key);
-				if (pos != relcount.end()) {
-					relcount[key]++;
-				} else {
-					relcount.insert(make_pair(key,1));
-				}
+		xmlXPathObjectPtr xpathobj = xmlXPathCompiledEval( job.xpath, job.ctx );
+		if (!xpathobj) throw "Doc::walkTreeXPath: xmlXPathCompiledEval failed";
+		//if (!xpathobj->nodesetval) throw "Doc::walkTreeXPath: xmlXPathCompiledEval didn't return result";
+		if (xpathobj->nodesetval) {
+			for (int i = 0; i < xpathobj->nodesetval->nodeNr; i++) {
+				xmlNodePtr cur = xpathobj->nodesetval->nodeTab[i];
+				/* find the corresponding Node in our data structure */
+				hashmap<xmlNodePtr, Node*, hashfun<void*> >::iterator found = xml_to_node.find(cur);
+				if (found != xml_to_node.end())
+					addRelation(job, node, found->second);
 			}
 		}
+		xmlXPathFreeObject(xpathobj);
 	}
-	xmlXPathFreeObject(xpathobj);
+}
 
-	/* recurse into children */
-	if (node->children)
-		for (NodeVec::iterator i = node->children->begin(); i != node->children->end(); i++)
-			walkTreeXPath(xpathctx, xpath, *i);
+bool
+Doc::isCompressed(const char* buffer, size_t size) {
+	/* gzip magic, libxml decompresses such files when reading them itself */
+	return size >= 2 && (unsigned char) buffer[0] == 0x1f && (unsigned char) buffer[1] == 0x8b;
 }
 
 bool
-Doc::loadXML(const char* filename) {
-	xmlNodePtr rootn = NULL;
-	if (dom) { flushDoc(); }
+Doc::loadXML(const char* filename, bool keepDOM) {
+	/* map regular files into memory, the parser reads them from there */
+	void* buffer = MAP_FAILED;
+	struct stat st;
+	int fd = open(filename, O_RDONLY);
+	if (fd >= 0) {
+		/* the parser takes the size as int */
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && st.st_size <= INT_MAX)
+			buffer = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+	}
+	if (buffer != MAP_FAILED && isCompressed((const char*) buffer, st.st_size)) {
+		munmap(buffer, st.st_size);
+		buffer = MAP_FAILED;
+	}
+
+	if (buffer == MAP_FAILED) {
+		/* pipes, compressed files and "-" for stdin are left to libxml */
+		if (root || dom) { flushDoc(); }
+		xmlTextReaderPtr reader = xmlReaderForFile(filename, NULL, 0);
+		if (!reader)
+			throw "Couldn't load document - can't open file";
+		return loadXMLReader(reader, keepDOM);
+	}
+
+	try {
+		loadXMLMemory((const char*) buffer, st.st_size, filename, keepDOM);
+	} catch (const char* error) {
+		munmap(buffer, st.st_size);
+		throw;
+	}
+	munmap(buffer, st.st_size);
+	return true;
+}
 
-	dom = xmlParseFile(filename);
+bool
+Doc::loadXMLMemory(const char* buffer, int size, const char* url, bool keepDOM) {
+	if (root || dom) { flushDoc(); }
 
-	if (!dom)
+	xmlTextReaderPtr reader = xmlReaderForMemory(buffer, size, url, NULL, 0);
+	if (!reader)
 		throw "Couldn't load document";
-	if (!dom->doc)
-		throw "Couldn't load document - no doc";
-	if (! (rootn = xmlDocGetRootElement(dom->doc)) )
-		throw "Couldn't load document - no root";
+	return loadXMLReader(reader, keepDOM);
+}
+
+bool
+Doc::loadXMLReader(xmlTextReaderPtr reader, bool keepDOM) {
+	try {
+		readTree(reader, keepDOM);
+	} catch (const char* error) {
+		if (keepDOM) dom = xmlTextReaderCurrentDoc(reader);
+		xmlFreeTextReader(reader);
+		throw;
+	}
+	/* the reader will not free the document once we have taken it */
+	if (keepDOM) dom = xmlTextReaderCurrentDoc(reader);
+	xmlFreeTextReader(reader);
 
-	walkTree(NULL,rootn);
+	if (!root)
+		throw "Couldn't load document - no root";
 
+	hashSubtrees();
 	return true;
 }
 
+/** \brief parameters and result of a document loading thread */
+struct LoadJob {
+	/** \brief document to be loaded */
+	Doc*		doc;
+	/** \brief file to be loaded */
+	const char*	filename;
+	/** \brief xpath for the relations */
+	const char*	xpath;
+	/** \brief keep the libxml DOM */
+	bool		keepDOM;
+	/** \brief snapshot cache directory, NULL for none */
+	const char*	cachedir;
+	/** \brief exception raised by the job, NULL on success */
+	const char*	error;
+};
+
+/* thread entry point: load and preprocess one document */
+static void* runLoadJob(void* arg) {
+	LoadJob* job = (LoadJob*) arg;
+	try {
+		if (job->cachedir) {
+			job->doc->loadCached(job->filename, job->xpath, job->cachedir, job->keepDOM);
+		} else {
+			job->doc->loadXML(job->filename, job->keepDOM);
+			job->doc->processXPath(job->xpath);
+		}
+	} catch (const char* error) {
+		job->error = error;
+	}
+	return NULL;
+}
+
+void
+Doc::loadPair(Doc& doc1, const char* file1, Doc& doc2, const char* file2, const char* xpath,
+		bool keepDOM, const char* cachedir) {
+	/* libxml must be initialized before it is used from several threads */
+	xmlInitParser();
+
+	LoadJob job1 = { &doc1, file1, xpath, keepDOM, cachedir, NULL };
+	LoadJob job2 = { &doc2, file2, xpath, keepDOM, cachedir, NULL };
+
+	/* second document in a new thread, first one in this thread */
+	pthread_t thread;
+	bool threaded = (pthread_create(&thread, NULL, runLoadJob, &job2) == 0);
+	runLoadJob(&job1);
+	if (threaded)
+		pthread_join(thread, NULL);
+	else
+		runLoadJob(&job2);
+
+	if (job1.error) throw job1.error;
+	if (job2.error) throw job2.error;
+}
+
+void*
+Doc::runRelJob(void* arg) {
+	RelJob* job = (RelJob*) arg;
+	try {
+		switch (job->axis) {
+		case AXIS_XPATH:
+			job->doc->walkTreeXPath(*job);
+			break;
+		case AXIS_DESCENDANT:
+			job->doc->countDescendants(*job);
+			break;
+		case AXIS_FOLLOWING_SIBLING:
+			job->doc->countSiblings(*job, REL_NONATTR);
+			break;
+		case AXIS_FOLLOWING_ELEMENT:
+			job->doc->countSiblings(*job, typeBit(Node::ELEMENT));
+			break;
+		default:
+			job->doc->walkTreeNative(*job);
+		}
+		job->part.finish(job->end - job->first);
+	} catch (const char* error) {
+		job->error = error;
+	}
+	return NULL;
+}
+
+void
+Doc::addRelation(RelJob& job, Node* node, Node* reln) {
+	/* register node as related */
+	job.part.add(reln);
+	/* do document relation count */
+	RelEqClass key(node, reln);
+	hashmap<RelEqClass, int, hash_releqc>::iterator pos = job.counts.find(key);
+	if (pos != job.counts.end()) {
+		pos->second++;
+	} else {
+		job.counts.insert(make_pair(key,1));
+	}
+}
+
+Doc::RelationAxis
+Doc::nativeAxis(const char* xp) {
+	/* compare ignoring whitespace */
+	string norm;
+	for (const char* c = xp; *c; c++)
+		if (!isspace((unsigned char) *c)) norm += *c;
+	if (norm == "./node()" || norm == "node()" || norm == "child::node()")
+		return AXIS_CHILD;
+	if (norm == "./*/node()" || norm == "*/node()")
+		return AXIS_GRANDCHILD;
+	if (norm == "./node()|./*/node()" || norm == "node()|*/node()")
+		return AXIS_CHILD_GRANDCHILD;
+	if (norm == ".//node()" || norm == "descendant::node()")
+		return AXIS_DESCENDANT;
+	if (norm == "following-sibling::node()" || norm == "./following-sibling::node()")
+		return AXIS_FOLLOWING_SIBLING;
+	if (norm == "following-sibling::*" || norm == "./following-sibling::*")
+		return AXIS_FOLLOWING_ELEMENT;
+	return AXIS_XPATH;
+}
+
+/* class counts of a changing set of nodes. Relating a new node to all
+ * of them takes one update per distinct class, not one per node. */
+class ClassCounts {
+private:
+	/* position of each class in counts */
+	hashmap<NodeEqClass, unsigned int, hash_NEqC>	index;
+	/* distinct classes with a non-zero count */
+	vector<pair<NodeEqClass, int> >	counts;
+public:
+	void add(Node* n, int d) {
+		NodeEqClass c(n);
+		hashmap<NodeEqClass, unsigned int, hash_NEqC>::iterator f = index.find(c);
+		if (f == index.end()) {
+			index.insert(make_pair(c, (unsigned int) counts.size()));
+			counts.push_back(make_pair(c, d));
+			return;
+		}
+		unsigned int i = f->second;
+		counts[i].second += d;
+		if (counts[i].second) return;
+		/* drop the class, moving the last one into its place */
+		index.erase(f);
+		if (i + 1 < counts.size()) {
+			counts[i] = counts.back();
+			index[counts[i].first] = i;
+		}
+		counts.pop_back();
+	}
+	void relate(hashmap<RelEqClass, int, hash_releqc>& relcount, const Node* n) const {
+		for (vector<pair<NodeEqClass, int> >::const_iterator i = counts.begin(); i != counts.end(); ++i)
+			relcount[RelEqClass(i->first, *n)] += i->second;
+	}
+	void clear() { index.clear(); counts.clear(); }
+};
+
+void
+Doc::countDescendants(RelJob& job) {
+	if (job.first >= job.end) return;
+	/* open ancestors of the current node, and their classes */
+	NodeVec stack;
+	ClassCounts active;
+	/* start with the ancestors of the first node of the range */
+	for (Node* a = nodes[job.first]->parent; a; a = a->parent)
+		stack.push_back(a);
+	reverse(stack.begin(), stack.end());
+	for (NodeVec::iterator a = stack.begin(); a != stack.end(); ++a)
+		active.add(*a, 1);
+
+	for (unsigned int id = job.first; id < job.end; id++) {
+		Node* node = nodes[id];
+		if (node->type == Node::ATTRIBUTE) continue;
+		while (!stack.empty() && stack.back()->last < node->id) {
+			active.add(stack.back(), -1);
+			stack.pop_back();
+		}
+		active.relate(job.counts, node);
+		active.add(node, 1);
+		stack.push_back(node);
+	}
+}
+
+void
+Doc::countSiblings(RelJob& job, unsigned int types) {
+	ClassCounts seen;
+	for (unsigned int id = job.first; id < job.end; id++) {
+		Node* node = nodes[id];
+		seen.clear();
+		for (NodeList::iterator c = node->children.begin(); c != node->children.end(); ++c) {
+			if ((*c)->type == Node::ATTRIBUTE) continue;
+			if (types & typeBit((*c)->type))
+				seen.relate(job.counts, *c);
+			seen.add(*c, 1);
+		}
+	}
+}
+
+void
+Doc::walkTreeNative(RelJob& job) {
+	/* attributes are on the attribute axis, not the child axis.
+	 * Adding each child directly followed by its own children
+	 * yields document order, as XPath node sets are sorted. */
+	for (unsigned int id = job.first; id < job.end; id++) {
+		Node* node = nodes[id];
+		job.part.startNode(id - job.first);
+		for (NodeList::iterator c = node->children.begin(); c != node->children.end(); ++c) {
+			Node* child = *c;
+			if (child->type == Node::ATTRIBUTE) continue;
+			if (job.axis != AXIS_GRANDCHILD)
+				addRelation(job, node, child);
+			if (job.axis == AXIS_CHILD || child->type != Node::ELEMENT) continue;
+			for (NodeList::iterator g = child->children.begin(); g != child->children.end(); ++g)
+				if ((*g)->type != Node::ATTRIBUTE)
+					addRelation(job, node, *g);
+		}
+	}
+}
+
+void
+Doc::buildRelations(RelationAxis axis, const char* xp) {
+	unsigned int n = nodes.size();
+	unsigned int threads = relationThreads;
+	if (!threads) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = (cpus > 0) ? cpus : 1;
+	}
+	/* small documents are not worth starting threads */
+	if (threads > n / REL_MIN_NODES) threads = n / REL_MIN_NODES;
+	if (threads < 1) threads = 1;
+
+	/* split into ranges of consecutive ids */
+	vector<RelJob> jobs(threads);
+	for (unsigned int t = 0; t < threads; t++) {
+		RelJob& job = jobs[t];
+		job.doc = this;
+		job.first = (unsigned long long) n * t / threads;
+		job.end = (unsigned long long) n * (t + 1) / threads;
+		job.axis = axis;
+		job.ctx = NULL;
+		job.xpath = NULL;
+		job.error = NULL;
+	}
+	/* each thread needs its own XPath context; compile up front */
+	const char* error = NULL;
+	if (axis == AXIS_XPATH) {
+		for (unsigned int t = 0; t < threads && !error; t++) {
+			jobs[t].ctx = xmlXPathNewContext(dom);
+			if (!jobs[t].ctx) { error = "Doc::processXPath - xmlXPathNewContext failed."; break; }
+			jobs[t].xpath = xmlXPathCtxtCompile(jobs[t].ctx, BAD_CAST xp);
+			if (!jobs[t].xpath) error = "Doc::processXPath - xmlXPathCtxtCompile failed. Invalid xpath expression.";
+		}
+	}
+
+	if (!error) {
+		/* first range in this thread, the others in new threads */
+		vector<pthread_t> thread(threads);
+		vector<bool> started(threads, false);
+		for (unsigned int t = 1; t < threads; t++)
+			started[t] = (pthread_create(&thread[t], NULL, runRelJob, &jobs[t]) == 0);
+		runRelJob(&jobs[0]);
+		for (unsigned int t = 1; t < threads; t++) {
+			if (started[t])
+				pthread_join(thread[t], NULL);
+			else
+				runRelJob(&jobs[t]);
+		}
+	}
+
+	/* merge, in document order */
+	size_t edges = 0;
+	for (unsigned int t = 0; t < threads; t++)
+		edges += jobs[t].part.edges();
+	/* for implicit relations, only the counts were built */
+	if (!reldown.implicit()) {
+		reldown.allocate(n, edges);
+		size_t at = 0;
+		for (unsigned int t = 0; t < threads; t++) {
+			reldown.fill(jobs[t].first, at, jobs[t].part);
+			at += jobs[t].part.edges();
+		}
+		relup.transpose(reldown, nodes);
+	}
+	for (unsigned int t = 0; t < threads; t++) {
+		RelJob& job = jobs[t];
+		for (hashmap<RelEqClass, int, hash_releqc>::iterator i = job.counts.begin(); i != job.counts.end(); ++i)
+			relcount[i->first] += i->second;
+		if (job.xpath) xmlXPathFreeCompExpr(job.xpath);
+		if (job.ctx) xmlXPathFreeContext(job.ctx);
+		if (!error) error = job.error;
+	}
+	if (error) throw error;
+}
+
 void
 Doc::processXPath(const char* xp) {
-	/* generate xpath setup */
-	xmlXPathContextPtr xpathctx = xmlXPathNewContext(dom);
-	if (!xpathctx) throw "Doc::processXPath - xmlXPathNewContext failed.";
-	xmlXPathCompExprPtr xpath = xmlXPathCtxtCompile(xpathctx, BAD_CAST xp);
-	if (!xpath) throw "Doc::processXPath - xmlXPathCtxtCompile failed. Invalid xpath expression.";
+	RelationAxis axis = nativeAxis(xp);
+	switch (axis) {
+	case AXIS_DESCENDANT:
+		reldown.setImplicit(RelGraph::DESCENDANT, nodes);
+		relup.setImplicit(RelGraph::ANCESTOR, nodes);
+		break;
+	case AXIS_FOLLOWING_SIBLING:
+	case AXIS_FOLLOWING_ELEMENT: {
+		unsigned int types = (axis == AXIS_FOLLOWING_ELEMENT) ? typeBit(Node::ELEMENT) : REL_NONATTR;
+		reldown.setImplicit(RelGraph::FOLLOWING_SIBLING, nodes, types);
+		relup.setImplicit(RelGraph::PRECEDING_SIBLING, nodes, types);
+		break;
+	}
+	case AXIS_XPATH:
+		if (!dom) throw "Doc::processXPath - document was loaded without DOM.";
+		/* fall through */
+	default:
+		reldown.clear();
+		relup.clear();
+	}
+	buildRelations(axis, xp);
+}
 
-	/* collect relations */
-	walkTreeXPath(xpathctx, xpath, root);
+void
+Doc::annotateRelations() {
+	reldown.annotate(nodes, false);
+	relup.annotate(nodes, true);
+}
 
-	xmlXPathFreeCompExpr(xpath);
-	xmlXPathFreeContext(xpathctx);
+void
+Doc::hashSubtrees() {
+	/* children have larger ids than their parents */
+	for (NodeVec::reverse_iterator n = nodes.rbegin(); n != nodes.rend(); ++n) {
+		Node* node = *n;
+		uint64_t h = mix64(((uint64_t) node->label.id() << 32 | node->content.id()) + node->type);
+		for (NodeList::iterator c = node->children.begin(); c != node->children.end(); ++c)
+			h = mix64(h * 31 + (*c)->treehash);
+		node->treehash = h;
+	}
 }
 
 #ifdef NEED_INDEX
@@ -129,54 +539,97 @@ void Doc::add_to_processed(xmlNodePtr node) {
 #endif
 
 void
-Doc::walkTree(Node* pos, xmlNodePtr node) {
-	Node* newnode=NULL;
-	xmlAttrPtr attr=NULL;
-	while (node) {
-		switch(node->type) {
-		case XML_ELEMENT_NODE:
-			newnode = appendNodeElement(pos,node);
+Doc::linkNode(Node* n, xmlNodePtr node) {
+	n->data = node;
 #ifdef NEED_PROCESSED_SET
-			add_to_processed(node);
+	add_to_processed(node);
 #endif
-			xml_to_node.insert(make_pair(node,newnode));
-			/* put into nodes vector */
-			nodes.push_back(newnode);
-			if (!root) { root = newnode; }
+	xml_to_node.insert(make_pair(node,n));
+}
+
+void
+Doc::addNode(Node* newnode, xmlNodePtr node) {
+	if (node) linkNode(newnode, node);
+	/* put into nodes vector, the position is the node id */
+	newnode->id = nodes.size();
+	newnode->last = newnode->id;
+	nodes.push_back(newnode);
 #ifdef NEED_INDEX
-			add_to_index(newnode);
+	add_to_index(newnode);
 #endif
+}
+
+/* add a node to the children collected for its parent */
+static inline void appendChild(NodeVec& children, Node* node) {
+	node->pos = children.size();
+	children.push_back(node);
+}
+
+void
+Doc::readTree(xmlTextReaderPtr reader, bool keepDOM) {
+	NameCache names;
+	/* current parent in the SSD::Node tree */
+	Node* pos = NULL;
+	Node* newnode = NULL;
+	/* children collected for each open element, by depth.
+	 * They are copied to the arena when the element is closed. */
+	vector<NodeVec> open;
+	unsigned int depth = 0;
+	int ret;
+	while ((ret = xmlTextReaderRead(reader)) == 1) {
+		/* keep every node in the tree, including ignored whitespace,
+		 * as the output writers reconstruct the document from it */
+		if (keepDOM) xmlTextReaderPreserve(reader);
+		xmlNodePtr node = xmlTextReaderCurrentNode(reader);
+		if (!node) continue;
+
+		if (xmlTextReaderNodeType(reader) == XML_READER_TYPE_END_ELEMENT) {
+			if (pos) {
+				pos->children.assign(arena, open[--depth]);
+				pos->last = nodes.size() - 1;
+				pos = pos->parent;
+			}
+			continue;
+		}
+		/* skip the prolog, we start at the root element */
+		if (!root && node->type != XML_ELEMENT_NODE) continue;
+
+		switch(node->type) {
+		case XML_ELEMENT_NODE:
+			newnode = appendNodeElement(pos, unifyName(names, xmlTextReaderConstName(reader)),
+				keepDOM ? node : NULL);
+			addNode(newnode, keepDOM ? node : NULL);
+			if (!root) { root = newnode; }
+			if (pos) appendChild(open[depth - 1], newnode);
+			if (open.size() <= depth) open.resize(depth + 1);
+			open[depth++].clear();
 
 			// parse attributes
-			attr = node->properties;
-			while(attr) {
-				Node* newattr = appendNodeAttribute(newnode,node,attr);
-#ifdef NEED_PROCESSED_SET
-				add_to_processed((xmlNodePtr)attr);
-#endif
-				xml_to_node.insert(make_pair((xmlNodePtr)attr,newattr));
-				/* put into nodes vector */
-				nodes.push_back(newattr);
-#ifdef NEED_INDEX
-				add_to_index(newattr);
-#endif
-				attr = attr->next;
+			while (xmlTextReaderMoveToNextAttribute(reader) == 1) {
+				/* namespace declarations are not attributes in the DOM */
+				if (xmlTextReaderIsNamespaceDecl(reader) == 1) continue;
+				xmlNodePtr attr = keepDOM ? xmlTextReaderCurrentNode(reader) : NULL;
+				Node* newattr = appendNodeAttribute(newnode,
+					unifyName(names, xmlTextReaderConstName(reader)),
+					ustring(xmlTextReaderConstValue(reader)), attr);
+				addNode(newattr, attr);
+				appendChild(open[depth - 1], newattr);
 			}
+			xmlTextReaderMoveToElement(reader);
 
-			walkTree(newnode,node->children);
+			/* empty elements don't get an end element event */
+			if (xmlTextReaderIsEmptyElement(reader)) {
+				newnode->children.assign(arena, open[--depth]);
+				newnode->last = nodes.size() - 1;
+			} else
+				pos = newnode;
 			break;
 		case XML_TEXT_NODE:
-			newnode = appendNodeText(pos,node);
+			if (!pos) break;
+			newnode = appendNodeText(pos, ustring(node->content), keepDOM ? node : NULL);
 			if (newnode) {
-#ifdef NEED_PROCESSED_SET
-				add_to_processed(node);
-#endif
-				xml_to_node.insert(make_pair(node,newnode));
-				/* put into nodes vector */
-				nodes.push_back(newnode);
-#ifdef NEED_INDEX
-				add_to_index(newnode);
-#endif
+				addNode(newnode, keepDOM ? node : NULL);
+				appendChild(open[depth - 1], newnode);
 			}
 			break;
 		case XML_COMMENT_NODE:
@@ -186,13 +639,13 @@ Doc::walkTree(Node* pos, xmlNodePtr node) {
 		default:
 			std::cerr << "Unsupported node type: " << node->type << std::endl;
 		}
-		node = node->next;
 	}
+	if (ret < 0)
+		throw "Couldn't load document";
 }
 
 Node*
-Doc::appendNodeElement(Node* parent, xmlNodePtr node) {
-	ustring name(node->name);
+Doc::appendNodeElement(Node* parent, ustring name, xmlNodePtr node) {
 #ifdef CAREFUL
 	if (name.empty()) {
 		std::cerr << "Element node without text!"<< std::endl;
@@ -200,33 +653,26 @@ Doc::appendNodeElement(Node* parent, xmlNodePtr node) {
 	}
 #endif
 	/* create the new node */
-	Node* newnode = new Node(name,empty_ustring,parent,node);
-	if (parent) parent->addChild(newnode);
+	Node* newnode = new (arena.alloc(sizeof(Node))) Node(name,empty_ustring,parent,Node::ELEMENT,node);
 //	std::cout << "Added labeled node '" << name << "'" << std::endl;
 	return newnode;
 }
 
 Node*
-Doc::appendNodeText(Node* parent, xmlNodePtr node) {
-	xmlChar* content = xmlNodeGetContent(node);
-	ustring value(content);
-	if (content) xmlFree(content);
+Doc::appendNodeText(Node* parent, ustring value, xmlNodePtr node) {
 	if (!useWhitespace && value.empty()) return NULL;
 
 	/* create the new node */
-	Node* newnode = new Node(empty_ustring,value,parent,node);
+	Node* newnode = new (arena.alloc(sizeof(Node))) Node(empty_ustring,value,parent,Node::TEXT,node);
 #ifdef CAREFUL
 	if (!parent) throw "No parent given for text node.";
 #endif
-	parent->addChild(newnode);
 //	std::cout << "Added text node" << std::endl;
 	return newnode;
 }
 
 Node*
-Doc::appendNodeAttribute(Node* parent, xmlNodePtr node, xmlAttrPtr attr) {
-	ustring name(attr->name);
-	ustring value(xmlNodeListGetString(node->doc,attr->children,1));
+Doc::appendNodeAttribute(Node* parent, ustring name, ustring value, xmlNodePtr attr) {
 #ifdef CAREFUL
 	if (name.empty()) {
 		std::cerr << "Attribute node without name... " << std::endl;
@@ -235,11 +681,10 @@ Doc::appendNodeAttribute(Node* parent, xmlNodePtr node, xmlAttrPtr attr) {
 #endif
 
 	/* create the new node */
-	Node* newnode = new Node(name,value,parent,attr);
+	Node* newnode = new (arena.alloc(sizeof(Node))) Node(name,value,parent,Node::ATTRIBUTE,attr);
 #ifdef CAREFUL
 	if (!parent) throw "No parent given von Attribute node.";
 #endif
-	parent->addChild(newnode);
 //	std::cout << "Added attribute node " << name << "='" << value << "'" << std::endl;
 	return newnode;
 }
@@ -16,6 +16,7 @@
 #include "node.h"
 #include "ustring.h"
 #include "node_eqclass.h"
+#include "rel_graph.h"
 #include "util.h"
 
 #include <vector>
@@ -24,6 +25,7 @@
 #include <set>
 
 #include <libxml/tree.h>
+#include <libxml/xmlreader.h>
 #include <libxml/xpath.h>
 
 using namespace std;
@@ -43,30 +45,84 @@ protected:
 
 	/** \brief list containing all nodes in the document for iteration */
 	NodeVec		nodes;
+	/** \brief storage for the nodes and their child and relation lists */
+	Arena		arena;
 
 	/* process a node in the reader */
-	/** \brief Walk the document tree recursively
-	 *  This will transform the libXML dom tree into a tree
-	 *  of SSD::Node objects
-	 *  \param pos  current position in SSD::Node tree when walking
-	 *  \param node current position in libxml tree */
-	void walkTree(Node* pos, xmlNodePtr node);
+	/** \brief Read the document from a libxml reader stream
+	 *  This will build the tree of SSD::Node objects directly
+	 *  while the document is being parsed.
+	 *  \param reader libxml reader positioned before the document
+	 *  \param keepDOM keep the libxml nodes for output reconstruction */
+	void readTree(xmlTextReaderPtr reader, bool keepDOM);
+	/** \brief load the document a reader was opened for, and free the reader
+	 *  \param reader libxml reader positioned before the document
+	 *  \param keepDOM keep the libxml DOM tree
+	 *  \return true on successful load */
+	bool loadXMLReader(xmlTextReaderPtr reader, bool keepDOM);
+	/** \brief test for file contents the libxml reader has to decompress
+	 *  \param buffer file contents
+	 *  \param size size of the file contents
+	 *  \return true for gzip data */
+	static bool isCompressed(const char* buffer, size_t size);
+	/** \brief register a new Node in the node list and lookup tables
+	 *  \param newnode Node object to be registered
+	 *  \param node corresponding libxml node, NULL without DOM */
+	void addNode(Node* newnode, xmlNodePtr node);
 	/** \brief Make a new element Node
 	 *  \param parent parent node for new element
-	 *  \param node libxml node information
+	 *  \param name element name
+	 *  \param node libxml node, NULL without DOM
 	 *  \return new Node object for this node */
-	Node* appendNodeElement(Node* parent, xmlNodePtr node);
+	Node* appendNodeElement(Node* parent, ustring name, xmlNodePtr node);
 	/** \brief Make a new "text" Node
 	 *  \param parent parent node for new element
-	 *  \param node libxml node information
-	 *  \return new Node object for this node */
-	Node* appendNodeText(Node* parent, xmlNodePtr node);
+	 *  \param value text content
+	 *  \param node libxml node, NULL without DOM
+	 *  \return new Node object for this node, NULL if ignored */
+	Node* appendNodeText(Node* parent, ustring value, xmlNodePtr node);
 	/** \brief Make a new "attribute" Node
 	 *  \param parent parent node for new element
-	 *  \param node parent libxml node
-	 *  \param attr libxml attribute
+	 *  \param name attribute name
+	 *  \param value attribute value
+	 *  \param attr libxml attribute, NULL without DOM
 	 *  \return new Node object for this node */
-	Node* appendNodeAttribute(Node* parent, xmlNodePtr node, xmlAttrPtr attr);
+	Node* appendNodeAttribute(Node* parent, ustring name, ustring value, xmlNodePtr attr);
+
+	/** \brief compute the structural hash of every subtree
+	 *
+	 *  bottom-up (Merkle) hash over type, label and content of all
+	 *  nodes of the subtree, including attributes, in document order */
+	void hashSubtrees();
+	/** \brief set the libxml node of a Node and register it in the lookup tables
+	 *  \param n Node object
+	 *  \param node corresponding libxml node */
+	void linkNode(Node* n, xmlNodePtr node);
+	/** \brief restore the Node tree and relations from a snapshot file
+	 *  \param filename snapshot file
+	 *  \param content hash of the document contents
+	 *  \param size size of the document
+	 *  \param xpath XPath expression the relations were built for
+	 *  \return false if the file is missing, invalid or for another document */
+	bool loadSnapshot(const char* filename, uint64_t content, uint64_t size, const char* xpath);
+	/** \brief write the Node tree and relations to a snapshot file
+	 *  \param filename snapshot file, replaced atomically
+	 *  \param content hash of the document contents
+	 *  \param size size of the document
+	 *  \param xpath XPath expression the relations were built for
+	 *  \return true on success */
+	bool saveSnapshot(const char* filename, uint64_t content, uint64_t size, const char* xpath) const;
+	/** \brief link the Nodes restored from a snapshot to a libxml DOM
+	 *
+	 *  the DOM is walked in the same order as readTree() creates Nodes
+	 *  \param doc DOM of the same document, taken over on success
+	 *  \return false if the DOM does not match the Node tree */
+	bool attachDOM(xmlDocPtr doc);
+	/** \brief link a DOM subtree, see attachDOM()
+	 *  \param node libxml node
+	 *  \param next id of the next Node to be linked
+	 *  \return false if the DOM does not match the Node tree */
+	bool attachNode(xmlNodePtr node, unsigned int& next);
 
 #ifdef NEED_INDEX
 	/** \brief insert a node into the index structure
@@ -82,16 +138,72 @@ protected:
 	void add_to_processed(xmlNodePtr node);
 #endif
 	
+	/** \brief relations of a range of nodes, built by one thread */
+	struct RelJob;
+	/** \brief thread function building the relations of a RelJob
+	 *  \param job RelJob to be processed
+	 *  \return NULL */
+	static void* runRelJob(void* job);
 	/** \brief walk document by using an xpath expression
 	 *
 	 *  this is used to build the list of related nodes for a given XPath expression
-	 *  \param xpathctx XPath context (allocated externally for efficiency)
-	 *  \param xpath compiled XPath expression (compiled exernally for efficiency)
-	 *  \param node reference node */
-	void walkTreeXPath(xmlXPathContextPtr xpathctx, xmlXPathCompExprPtr xpath, Node* node);
+	 *  \param job range of nodes, with XPath context and compiled expression */
+	void walkTreeXPath(RelJob& job);
+	/** \brief relation axes generated directly from the Node tree */
+	enum RelationAxis {
+		/** \brief no native generator, evaluate the XPath expression */
+		AXIS_XPATH,
+		/** \brief "./node()" */
+		AXIS_CHILD,
+		/** \brief the children of the child elements */
+		AXIS_GRANDCHILD,
+		/** \brief the children and the children of the child elements, the default */
+		AXIS_CHILD_GRANDCHILD,
+		/** \brief ".//node()", implicit */
+		AXIS_DESCENDANT,
+		/** \brief "following-sibling::node()", implicit */
+		AXIS_FOLLOWING_SIBLING,
+		/** \brief "following-sibling::*", implicit */
+		AXIS_FOLLOWING_ELEMENT
+	};
+	/** \brief find a native generator for an XPath expression
+	 *  \param xpath XPath expression as given by the user
+	 *  \return axis to use, AXIS_XPATH if there is no native generator */
+	static RelationAxis nativeAxis(const char* xpath);
+	/** \brief walk document using a native relation generator
+	 *
+	 *  produces the same relations (in the same order) as the
+	 *  corresponding XPath expression, without evaluating it
+	 *  \param job range of nodes, axis AXIS_CHILD, AXIS_GRANDCHILD or AXIS_CHILD_GRANDCHILD */
+	void walkTreeNative(RelJob& job);
+	/** \brief count the descendant relation
+	 *
+	 *  the pairs are not enumerated; each node is counted once against
+	 *  the classes of all its ancestors, aggregated by class
+	 *  \param job range of nodes to be counted as descendants */
+	void countDescendants(RelJob& job);
+	/** \brief count the following sibling relation
+	 *  \param job range of parent nodes whose children are counted
+	 *  \param types node types that are related to their preceding siblings */
+	void countSiblings(RelJob& job, unsigned int types);
+	/** \brief register a relation of the node last passed to startNode()
+	 *  \param job job building the relation
+	 *  \param node reference node
+	 *  \param reln related node */
+	void addRelation(RelJob& job, Node* node, Node* reln);
+	/** \brief build the relations using several threads
+	 *
+	 *  The nodes are split into ranges of consecutive ids, each range is
+	 *  processed by its own thread with its own relation counts. The
+	 *  results are merged afterwards, in document order.
+	 *  \param axis relation axis
+	 *  \param xpath XPath expression, for AXIS_XPATH */
+	void buildRelations(RelationAxis axis, const char* xpath);
 public:
 	/** \brief flag wheter to ignore whitespace or not */
 	static bool useWhitespace;
+	/** \brief maximum number of threads building relations, 0 for one per CPU */
+	static unsigned int relationThreads;
 #ifdef NEED_INDEX
 	/** \brief index of nodes by label */
 	NodeEqClassVec	index_by_label;
@@ -102,16 +214,79 @@ public:
 #endif
 	/** \brief map to find the Node object for a given libxml node */
 	hashmap<xmlNodePtr, Node*, hashfun<void*> >	xml_to_node;
+	/** \brief related nodes in "down" direction, by node id */
+	RelGraph	reldown;
+	/** \brief related nodes in "upward" direction, by node id */
+	RelGraph	relup;
 	/** \brief count of relations in file to calculate credits */
 	hashmap<RelEqClass, int, hash_releqc>		relcount;
 
-	/** \brief load an XML document using libxml
+	/** \brief load an XML document using the libxml reader
+	 *
+	 *  Regular files are mapped into memory; pipes, compressed files
+	 *  and "-" for the standard input are read by libxml itself.
+	 *  The Node tree is built while parsing. The libxml DOM is only kept
+	 *  when requested; it is needed by processXPath() and by the output
+	 *  writers for reconstruction. Without it, Node::data is NULL.
 	 *  \param filename filename to be loaded
+	 *  \param keepDOM keep the libxml DOM tree
+	 *  \return true on successful load */
+	bool loadXML(const char* filename, bool keepDOM = true);
+	/** \brief load an XML document from memory using the libxml reader
+	 *  \param buffer document data
+	 *  \param size size of the document data
+	 *  \param url base URL of the document, for error messages
+	 *  \param keepDOM keep the libxml DOM tree
 	 *  \return true on successful load */
-	bool loadXML(const char* filename);
+	bool loadXMLMemory(const char* buffer, int size, const char* url, bool keepDOM = true);
+	/** \brief load and preprocess a document using a snapshot cache
+	 *
+	 *  Snapshots of the preprocessed document are kept in a cache directory,
+	 *  keyed by a hash of the document contents and of the XPath expression.
+	 *  If there is one, the Node tree, relations and relation counts are
+	 *  read from it instead of being rebuilt; the DOM, if requested, is
+	 *  still parsed. Otherwise the document is loaded and processed as
+	 *  usual and the snapshot is written. Pipes and compressed files are
+	 *  loaded without the cache.
+	 *
+	 *  The output writers need the DOM, so for a diff this mostly saves
+	 *  the evaluation of the XPath expression; the whole document is
+	 *  still read, hashed and parsed.
+	 *  \param filename filename to be loaded
+	 *  \param xpath XPath expression to be used for the relations
+	 *  \param cachedir directory containing the snapshots
+	 *  \param keepDOM keep the libxml DOM tree
+	 *  \return true if a snapshot was used */
+	bool loadCached(const char* filename, const char* xpath, const char* cachedir, bool keepDOM = true);
+	/** \brief load and preprocess two documents concurrently
+	 *
+	 *  Runs loadXML() and processXPath() for both documents, the second
+	 *  one in a separate thread. Both documents must belong to the same
+	 *  DiffSession. Exceptions are passed on after both threads finished.
+	 *  \param doc1 first document
+	 *  \param file1 file to be loaded into the first document
+	 *  \param doc2 second document
+	 *  \param file2 file to be loaded into the second document
+	 *  \param xpath XPath expression to be used for the relations
+	 *  \param keepDOM keep the libxml DOM trees
+	 *  \param cachedir snapshot cache directory, see loadCached(), NULL for none */
+	static void loadPair(Doc& doc1, const char* file1, Doc& doc2, const char* file2, const char* xpath,
+		bool keepDOM = true, const char* cachedir = NULL);
 	/** \brief build related-to data for a given xpath
+	 *
+	 *  The common expressions (child, grandchild, descendant, following
+	 *  sibling and the default union of child and grandchild) are generated
+	 *  directly from the Node tree, which also works for documents loaded
+	 *  without DOM. The transitive ones are not stored but derived from the
+	 *  interval numbering of the nodes, see RelGraph. Any other expression
+	 *  is evaluated by libxml for every node.
 	 *  \param xpath XPath expression to be used */
 	void processXPath(const char* xpath);
+	/** \brief annotate the stored relations with their RelCount slots
+	 *
+	 *  to be called once the RelCount index of the diff is set up,
+	 *  see RelGraph::annotate(). */
+	void annotateRelations();
 	/** \brief create an empty doc object */
 	Doc();
 	/** \brief drop document information */
@@ -123,6 +298,10 @@ public:
 	/** \brief return libxml DOM root node for document
 	 *  this is used in output writers for reconstruction */
 	xmlDocPtr getDOM() const { return dom; }
+	/** \brief number of nodes in the document */
+	unsigned int size() const { return nodes.size(); }
+	/** \brief node by id */
+	Node* getNode(unsigned int id) const { return nodes[id]; }
 	/** \brief access to const iterators of nodes list */
 	NodeVec::const_iterator getNodesIter() const { return nodes.begin(); }
 	NodeVec::const_iterator getNodesIterEnd() const { return nodes.end(); }
@@ -0,0 +1,453 @@
+/* ===========================================================================
+ *        Filename:  doc_snapshot.cc
+ *     Description:  Binary snapshots of preprocessed documents
+ *
+ *         Version:  $Rev$
+ *         Changed:  $Date$
+ *         Licence:  GPL (read COPYING file for details)
+ *
+ *          Author:  Erich Schubert (eS), erich@debian.org
+ *                   Institut für Informatik, LMU München
+ * ======================================================================== */
+#include "config.h"
+#include "doc.h"
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <algorithm>
+
+#include <libxml/parser.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace SSD {
+
+/* Snapshot file layout, all in native byte order:
+ *
+ *   SnapshotHeader
+ *   SnapshotNode     nodes[header.nodes]         by node id
+ *   uint32_t         offset[header.nodes + 1]    only for explicit relations
+ *   uint32_t         target[header.edges]        node ids
+ *   SnapshotClass    classes[header.classes]     relation counts
+ *   uint32_t         strings[header.strings]     offsets into the string data
+ *   char             data[header.stringbytes]    zero terminated strings
+ *
+ * String references are indexes into the string table, 0 is the empty
+ * string. The version must be increased whenever the layout changes. */
+
+#define SNAPSHOT_MAGIC "SSDSNAP"
+#define SNAPSHOT_VERSION 1
+/* no such node */
+#define SNAPSHOT_NONE 0xffffffffU
+
+/** \brief snapshot file header */
+struct SnapshotHeader {
+	/** \brief SNAPSHOT_MAGIC */
+	char		magic[8];
+	/** \brief SNAPSHOT_VERSION */
+	uint32_t	version;
+	/** \brief value of Doc::useWhitespace */
+	uint32_t	whitespace;
+	/** \brief hash of the document contents */
+	uint64_t	content;
+	/** \brief size of the document */
+	uint64_t	size;
+	/** \brief hash of the XPath expression */
+	uint64_t	xpath;
+	/** \brief RelGraph::Kind of the down relations */
+	uint32_t	kind;
+	/** \brief node types of the sibling relations */
+	uint32_t	types;
+	/** \brief number of nodes */
+	uint32_t	nodes;
+	/** \brief number of stored relations */
+	uint32_t	edges;
+	/** \brief number of relation count entries */
+	uint32_t	classes;
+	/** \brief number of strings, including the empty string */
+	uint32_t	strings;
+	/** \brief size of the string data */
+	uint32_t	stringbytes;
+	/** \brief unused, keeps the size a multiple of 8 */
+	uint32_t	reserved;
+};
+
+/** \brief snapshot record of a node */
+struct SnapshotNode {
+	/** \brief label string */
+	uint32_t	label;
+	/** \brief content string */
+	uint32_t	content;
+	/** \brief parent id, SNAPSHOT_NONE for the root */
+	uint32_t	parent;
+	/** \brief id of the last node in the subtree */
+	uint32_t	last;
+	/** \brief Node::Type */
+	uint32_t	type;
+};
+
+/** \brief snapshot record of a relation count */
+struct SnapshotClass {
+	/** \brief first label string */
+	uint32_t	fl;
+	/** \brief first content string */
+	uint32_t	fc;
+	/** \brief second label string */
+	uint32_t	sl;
+	/** \brief second content string */
+	uint32_t	sc;
+	/** \brief number of relations of this class */
+	int32_t		count;
+};
+
+/* order of the relation counts in a snapshot, so that it does not depend
+ * on the order the counts were built in */
+static bool classBefore(const SnapshotClass& a, const SnapshotClass& b) {
+	if (a.fl != b.fl) return a.fl < b.fl;
+	if (a.fc != b.fc) return a.fc < b.fc;
+	if (a.sl != b.sl) return a.sl < b.sl;
+	return a.sc < b.sc;
+}
+
+/* map a whole regular file read-only, NULL on failure */
+static const char* mapFile(const char* filename, size_t* size) {
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) return NULL;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+		close(fd);
+		return NULL;
+	}
+	void* buffer = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (buffer == MAP_FAILED) return NULL;
+	*size = st.st_size;
+	return (const char*) buffer;
+}
+
+/* hash of the settings the relations depend on */
+static uint64_t xpathKey(const char* xpath) {
+	return mix64(hash_bytes(xpath, strlen(xpath)) ^ (Doc::useWhitespace ? 1 : 0));
+}
+
+/* string table being written */
+class SnapshotStrings {
+public:
+	/* snapshot index by string id */
+	hashmap<unsigned int, uint32_t, hashfun<unsigned int> >	index;
+	/* strings in snapshot order, index 0 is the empty string */
+	vector<const char*>	strings;
+
+	SnapshotStrings() : strings(1, (const char*) NULL) { }
+	uint32_t get(ustring s) {
+		if (s.empty()) return 0;
+		hashmap<unsigned int, uint32_t, hashfun<unsigned int> >::iterator f = index.find(s.id());
+		if (f != index.end()) return f->second;
+		uint32_t i = strings.size();
+		strings.push_back(s.c_str());
+		index.insert(make_pair(s.id(), i));
+		return i;
+	}
+};
+
+bool
+Doc::saveSnapshot(const char* filename, uint64_t content, uint64_t size, const char* xpath) const {
+	SnapshotHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+	header.version = SNAPSHOT_VERSION;
+	header.whitespace = useWhitespace ? 1 : 0;
+	header.content = content;
+	header.size = size;
+	header.xpath = xpathKey(xpath);
+	header.kind = reldown.getKind();
+	header.types = reldown.getTypes();
+	header.nodes = nodes.size();
+	header.edges = reldown.edges();
+	header.classes = relcount.size();
+
+	SnapshotStrings strings;
+	vector<SnapshotNode> records(nodes.size());
+	for (unsigned int id = 0; id < nodes.size(); id++) {
+		const Node* n = nodes[id];
+		records[id].label = strings.get(n->label);
+		records[id].content = strings.get(n->content);
+		records[id].parent = n->parent ? n->parent->id : SNAPSHOT_NONE;
+		records[id].last = n->last;
+		records[id].type = n->type;
+	}
+	vector<uint32_t> offset, target;
+	if (!reldown.implicit()) {
+		offset.reserve(nodes.size() + 1);
+		target.reserve(reldown.edges());
+		for (unsigned int id = 0; id < nodes.size(); id++) {
+			offset.push_back(target.size());
+			RelList l = reldown[nodes[id]];
+			for (RelList::iterator i = l.begin(); i != l.end(); ++i)
+				target.push_back((*i)->id);
+		}
+		offset.push_back(target.size());
+	}
+	vector<SnapshotClass> classes;
+	classes.reserve(relcount.size());
+	for (hashmap<RelEqClass, int, hash_releqc>::const_iterator i = relcount.begin(); i != relcount.end(); ++i) {
+		SnapshotClass c;
+		c.fl = strings.get(i->first.firstLabel());
+		c.fc = strings.get(i->first.firstContent());
+		c.sl = strings.get(i->first.secondLabel());
+		c.sc = strings.get(i->first.secondContent());
+		c.count = i->second;
+		classes.push_back(c);
+	}
+	sort(classes.begin(), classes.end(), classBefore);
+	vector<uint32_t> stroffset(strings.strings.size(), 0);
+	uint32_t bytes = 0;
+	for (unsigned int i = 1; i < strings.strings.size(); i++) {
+		stroffset[i] = bytes;
+		bytes += strlen(strings.strings[i]) + 1;
+	}
+	header.strings = strings.strings.size();
+	header.stringbytes = bytes;
+
+	/* write to a temporary file, then move it into place */
+	char tmpname[4096];
+	snprintf(tmpname, sizeof(tmpname), "%s.%ld.%p.tmp", filename, (long) getpid(), (const void*) this);
+	FILE* out = fopen(tmpname, "wb");
+	if (!out) return false;
+	bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+	if (!records.empty())
+		ok = ok && fwrite(&records[0], sizeof(SnapshotNode), records.size(), out) == records.size();
+	if (!offset.empty())
+		ok = ok && fwrite(&offset[0], sizeof(uint32_t), offset.size(), out) == offset.size();
+	if (!target.empty())
+		ok = ok && fwrite(&target[0], sizeof(uint32_t), target.size(), out) == target.size();
+	if (!classes.empty())
+		ok = ok && fwrite(&classes[0], sizeof(SnapshotClass), classes.size(), out) == classes.size();
+	ok = ok && fwrite(&stroffset[0], sizeof(uint32_t), stroffset.size(), out) == stroffset.size();
+	for (unsigned int i = 1; ok && i < strings.strings.size(); i++)
+		ok = fwrite(strings.strings[i], strlen(strings.strings[i]) + 1, 1, out) == 1;
+	ok = (fclose(out) == 0) && ok;
+	if (ok) ok = (rename(tmpname, filename) == 0);
+	if (!ok) unlink(tmpname);
+	return ok;
+}
+
+bool
+Doc::loadSnapshot(const char* filename, uint64_t content, uint64_t size, const char* xpath) {
+	size_t len;
+	const char* data = mapFile(filename, &len);
+	if (!data) return false;
+
+	const SnapshotHeader* header = (const SnapshotHeader*) data;
+	/* check the header and the size of the sections, the header fields
+	 * only once the file is known to hold one */
+	bool valid = len >= sizeof(SnapshotHeader)
+		&& memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0;
+	bool explicitrel = valid && (header->kind == RelGraph::EXPLICIT);
+	valid = valid
+		&& header->version == SNAPSHOT_VERSION
+		&& header->whitespace == (useWhitespace ? 1U : 0U)
+		&& header->content == content && header->size == size
+		&& header->xpath == xpathKey(xpath)
+		&& (header->kind == RelGraph::EXPLICIT || header->kind == RelGraph::DESCENDANT
+			|| header->kind == RelGraph::FOLLOWING_SIBLING)
+		&& header->nodes > 0 && header->strings > 0
+		&& (explicitrel || header->edges == 0);
+	size_t need = sizeof(SnapshotHeader);
+	if (valid) {
+		need += (size_t) header->nodes * sizeof(SnapshotNode)
+			+ (explicitrel ? ((size_t) header->nodes + 1) * sizeof(uint32_t) : 0)
+			+ (size_t) header->edges * sizeof(uint32_t)
+			+ (size_t) header->classes * sizeof(SnapshotClass)
+			+ (size_t) header->strings * sizeof(uint32_t)
+			+ header->stringbytes;
+		valid = (len == need);
+	}
+	if (!valid) {
+		munmap((void*) data, len);
+		return false;
+	}
+	const SnapshotNode* records = (const SnapshotNode*) (header + 1);
+	const uint32_t* offset = (const uint32_t*) (records + header->nodes);
+	const uint32_t* target = offset + (explicitrel ? header->nodes + 1 : 0);
+	const SnapshotClass* classes = (const SnapshotClass*) (target + header->edges);
+	const uint32_t* stroffset = (const uint32_t*) (classes + header->classes);
+	const char* strdata = (const char*) (stroffset + header->strings);
+
+	/* check all references before building anything */
+	unsigned int n = header->nodes;
+	for (unsigned int i = 1; valid && i < header->strings; i++)
+		valid = stroffset[i] < header->stringbytes;
+	valid = valid && (header->stringbytes == 0 || strdata[header->stringbytes - 1] == 0);
+	for (unsigned int id = 0; valid && id < n; id++) {
+		const SnapshotNode& r = records[id];
+		valid = r.label < header->strings && r.content < header->strings
+			&& r.type <= Node::ATTRIBUTE && r.last >= id && r.last < n
+			&& ((id == 0) ? r.parent == SNAPSHOT_NONE : r.parent < id)
+			&& (id == 0 || (id <= records[r.parent].last && r.last <= records[r.parent].last));
+	}
+	for (unsigned int id = 0; valid && explicitrel && id < n; id++)
+		valid = offset[id] <= offset[id + 1];
+	valid = valid && (!explicitrel || (offset[0] == 0 && offset[n] == header->edges));
+	for (unsigned int e = 0; valid && e < header->edges; e++)
+		valid = target[e] < n;
+	for (unsigned int c = 0; valid && c < header->classes; c++)
+		valid = classes[c].fl < header->strings && classes[c].fc < header->strings
+			&& classes[c].sl < header->strings && classes[c].sc < header->strings;
+	if (!valid) {
+		munmap((void*) data, len);
+		return false;
+	}
+
+	if (root || dom) { flushDoc(); }
+	/* unify the strings in the current session */
+	vector<ustring> strings(header->strings, empty_ustring);
+	for (unsigned int i = 1; i < header->strings; i++)
+		strings[i] = ustring(strdata + stroffset[i]);
+
+	/* nodes, in id order, so every parent exists before its children */
+	vector<unsigned int> children(n, 0);
+	nodes.reserve(n);
+	for (unsigned int id = 0; id < n; id++) {
+		const SnapshotNode& r = records[id];
+		Node* parent = (r.parent == SNAPSHOT_NONE) ? NULL : nodes[r.parent];
+		Node* node = new (arena.alloc(sizeof(Node))) Node(strings[r.label], strings[r.content],
+			parent, (Node::Type) r.type, NULL);
+		addNode(node, NULL);
+		node->last = r.last;
+		if (parent) node->pos = children[r.parent]++;
+	}
+	for (unsigned int id = 0; id < n; id++)
+		nodes[id]->children.reserve(arena, children[id]);
+	for (unsigned int id = 1; id < n; id++) {
+		NodeList& l = nodes[id]->parent->children;
+		l.items[l.count++] = nodes[id];
+	}
+	root = nodes[0];
+	hashSubtrees();
+
+	/* relations */
+	RelGraph::Kind kind = (RelGraph::Kind) header->kind;
+	if (explicitrel) {
+		reldown.clear();
+		for (unsigned int id = 0; id < n; id++) {
+			reldown.startNode(id);
+			for (uint32_t e = offset[id]; e < offset[id + 1]; e++)
+				reldown.add(nodes[target[e]]);
+		}
+		reldown.finish(n);
+		relup.transpose(reldown, nodes);
+	} else {
+		reldown.setImplicit(kind, nodes, header->types);
+		relup.setImplicit((kind == RelGraph::DESCENDANT) ? RelGraph::ANCESTOR : RelGraph::PRECEDING_SIBLING,
+			nodes, header->types);
+	}
+	for (unsigned int c = 0; c < header->classes; c++) {
+		RelEqClass key(strings[classes[c].fl], strings[classes[c].fc],
+			strings[classes[c].sl], strings[classes[c].sc]);
+		relcount[key] += classes[c].count;
+	}
+
+	munmap((void*) data, len);
+	return true;
+}
+
+bool
+Doc::attachNode(xmlNodePtr node, unsigned int& next) {
+	switch (node->type) {
+	case XML_ELEMENT_NODE: {
+		if (next >= nodes.size() || nodes[next]->type != Node::ELEMENT) return false;
+		linkNode(nodes[next++], node);
+		for (xmlAttrPtr attr = node->properties; attr; attr = attr->next) {
+			if (next >= nodes.size() || nodes[next]->type != Node::ATTRIBUTE) return false;
+			linkNode(nodes[next++], (xmlNodePtr) attr);
+		}
+		for (xmlNodePtr child = node->children; child; child = child->next)
+			if (!attachNode(child, next)) return false;
+		return true;
+	}
+	case XML_TEXT_NODE:
+		/* same test as appendNodeText() */
+		if (!useWhitespace && ustring(node->content).empty()) return true;
+		if (next >= nodes.size() || nodes[next]->type != Node::TEXT) return false;
+		linkNode(nodes[next++], node);
+		return true;
+	default:
+		/* ignored by readTree() as well */
+		return true;
+	}
+}
+
+bool
+Doc::attachDOM(xmlDocPtr doc) {
+	xmlNodePtr top = xmlDocGetRootElement(doc);
+	unsigned int next = 0;
+	if (!top || !attachNode(top, next) || next != nodes.size()) {
+		/* unlink again */
+		for (NodeVec::iterator i = nodes.begin(); i != nodes.end(); ++i)
+			(*i)->data = NULL;
+#ifdef NEED_PROCESSED_SET
+		processed.clear();
+#endif
+		xml_to_node.clear();
+		return false;
+	}
+	dom = doc;
+	return true;
+}
+
+bool
+Doc::loadCached(const char* filename, const char* xpath, const char* cachedir, bool keepDOM) {
+	size_t size;
+	const char* buffer = mapFile(filename, &size);
+	/* the parser takes the size as int */
+	if (buffer && (size > INT_MAX || isCompressed(buffer, size))) {
+		munmap((void*) buffer, size);
+		buffer = NULL;
+	}
+	if (!buffer) {
+		/* pipes and compressed files are loaded without the cache */
+		loadXML(filename, keepDOM);
+		processXPath(xpath);
+		return false;
+	}
+
+	uint64_t content = hash_bytes(buffer, size);
+	char snapshot[4096];
+	snprintf(snapshot, sizeof(snapshot), "%s/%016llx-%016llx.snap", cachedir,
+		(unsigned long long) content, (unsigned long long) xpathKey(xpath));
+
+	bool cached = false;
+	try {
+		if (loadSnapshot(snapshot, content, size, xpath)) {
+			cached = true;
+			if (keepDOM) {
+				/* same parser options as loadXMLMemory() */
+				xmlDocPtr doc = xmlReadMemory(buffer, size, filename, NULL, 0);
+				if (!doc || !attachDOM(doc)) {
+					if (doc) xmlFreeDoc(doc);
+					flushDoc();
+					cached = false;
+				}
+			}
+		}
+		if (!cached) {
+			loadXMLMemory(buffer, size, filename, keepDOM);
+			processXPath(xpath);
+			if (!saveSnapshot(snapshot, content, size, xpath))
+				std::cerr << "Couldn't write snapshot " << snapshot << std::endl;
+		}
+	} catch (const char* error) {
+		munmap((void*) buffer, size);
+		throw;
+	}
+	munmap((void*) buffer, size);
+	return cached;
+}
+
+}
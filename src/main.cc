@@ -10,6 +10,8 @@
  *                   Institut für Informatik, LMU München
  * ======================================================================== */
 #include <iostream>
+#include <cstdlib>
+#include "session.h"
 #include "doc.h"
 #include "diff.h"
 #include "out_xupdate.h"
@@ -17,6 +19,7 @@
 #include "out_merged.h"
 
 #include "unistd.h"
+#include <getopt.h>
 
 using namespace SSD;
 
@@ -33,7 +36,7 @@ void usage(char* progname) {
 #ifdef TRACING_ENABLED
 		" [-t trace.dat]" <<
 #endif
-		" [-p xpath] [-w] document1.xml document2.xml" << endl;
+		" [-p xpath] [-c cachedir] [-w] document1.xml document2.xml" << endl;
 #ifdef TRACING_ENABLED
 	cerr << "    -t trace.dat        Dump search information for analysis" << endl;
 #endif
@@ -43,37 +46,106 @@ void usage(char* progname) {
 	cerr << "    -u                  Use 'xupdate' output format" << endl;
 	cerr << "    -f                  Use fast mode (approximative, default)" << endl;
 	cerr << "    -e                  Use exact mode (really slow)" << endl;
+	cerr << "    -b width            Use beam mode, keeping the best width states per node" << endl;
+	cerr << "    -s weight           Use weighted mode, at most weight times the exact costs" << endl;
+	cerr << "    -l states           Keep at most states search states in exact or weighted mode (-e, -s or -d)" << endl;
+	cerr << "    -d, --deadline secs Use exact mode, returning the best result secs seconds after the start" << endl;
+	cerr << "                        (the fast mode's result is always completed first)" << endl;
+	cerr << "    -j threads          Use threads for the exact mode (-e only, not with -l)" << endl;
+	cerr << "    -n                  Don't match identical subtrees before the search" << endl;
 	cerr << "    -p xpath            Use a different xpath statement for structure" << endl;
 	cerr << "    -p './/node()'      Use descendant relation" << endl;
 	cerr << "    -p './node()'       Use child relation" << endl;
+	cerr << "    -c cachedir         Cache the relations of the documents in cachedir" << endl;
+	cerr << "                        (the documents are still parsed for the output)" << endl;
+	cerr << "    -r threads          Build the relations with at most threads threads" << endl;
 }
 
+/* long names of options */
+static struct option longOptions[] = {
+	{ "deadline", required_argument, NULL, 'd' },
+	{ NULL, 0, NULL, 0 }
+};
+
 int main(int argc, char** argv) {
+	/* the session must outlive the documents */
+	DiffSession	session;
 	Doc		doc1;
 	Doc		doc2;
 
 	// use 'merged' output format by default for now
 	int output = 1;
 	const char* xpath = DEFAULT_PATH;
+	const char* cachedir = NULL;
 
 	// make fast mode the default
 	DiffDijkstra::fastApproximativeMode = true;
 
 	int option_char;
 	while (1) {
-		option_char = getopt(argc, argv, "efamuwt:p:");
+		option_char = getopt_long(argc, argv, "efamnuwb:s:l:d:j:t:p:c:r:", longOptions, NULL);
 		if (option_char < 0) break;
 		switch (option_char) {
 #ifdef TRACING_ENABLED
 			case 't': DiffDijkstra::setSearchTreeOutput(optarg); break;
 #endif
 			case 'p': xpath = optarg; break;
+			case 'c': cachedir = optarg; break;
+			case 'r':
+				if (atoi(optarg) < 1) {
+					usage(argv[0]);
+					return(0);
+				}
+				Doc::relationThreads = atoi(optarg);
+				break;
 			case 'w': Doc::useWhitespace = true; break;
 			case 'u': output = 0; break;
 			case 'm': output = 1; break;
 			case 'a': output = 2; break;
-			case 'f': DiffDijkstra::fastApproximativeMode = true; break;
-			case 'e': DiffDijkstra::fastApproximativeMode = false; break;
+			case 'f': DiffDijkstra::fastApproximativeMode = true; DiffDijkstra::beamWidth = 0; DiffDijkstra::weight = 0; DiffDijkstra::deadline = 0; break;
+			case 'e': DiffDijkstra::fastApproximativeMode = false; DiffDijkstra::beamWidth = 0; DiffDijkstra::weight = 0; DiffDijkstra::deadline = 0; break;
+			case 'b':
+				if (atoi(optarg) < 1) {
+					usage(argv[0]);
+					return(0);
+				}
+				DiffDijkstra::beamWidth = atoi(optarg);
+				DiffDijkstra::weight = 0;
+				DiffDijkstra::deadline = 0;
+				break;
+			case 's':
+				if (!(atof(optarg) >= 1)) {
+					usage(argv[0]);
+					return(0);
+				}
+				DiffDijkstra::fastApproximativeMode = false;
+				DiffDijkstra::beamWidth = 0;
+				DiffDijkstra::weight = atof(optarg);
+				break;
+			case 'l':
+				if (atol(optarg) < 1) {
+					usage(argv[0]);
+					return(0);
+				}
+				DiffDijkstra::queueLimit = atol(optarg);
+				break;
+			case 'd':
+				if (!(atof(optarg) > 0)) {
+					usage(argv[0]);
+					return(0);
+				}
+				DiffDijkstra::fastApproximativeMode = false;
+				DiffDijkstra::beamWidth = 0;
+				DiffDijkstra::deadline = atof(optarg);
+				break;
+			case 'j':
+				if (atoi(optarg) < 1) {
+					usage(argv[0]);
+					return(0);
+				}
+				DiffDijkstra::threads = atoi(optarg);
+				break;
+			case 'n': DiffDijkstra::prematchSubtrees = false; break;
 			case '?':
 				usage(argv[0]);
 				return(0);
@@ -86,18 +158,25 @@ int main(int argc, char** argv) {
 		return(0);
 	}
 
+	/* the fast and the beam mode keep no queue to be limited */
+	if (DiffDijkstra::queueLimit && (DiffDijkstra::fastApproximativeMode || DiffDijkstra::beamWidth)) {
+		usage(argv[0]);
+		return(0);
+	}
+
+	/* the other modes search on one thread */
+	if (DiffDijkstra::threads > 1 && (DiffDijkstra::fastApproximativeMode || DiffDijkstra::beamWidth
+			|| DiffDijkstra::weight || DiffDijkstra::queueLimit || DiffDijkstra::deadline)) {
+		usage(argv[0]);
+		return(0);
+	}
+
 	try {
 
-		if (!doc1.loadXML(argv[optind])) {
-			std::cerr << "Could not load: " << argv[1] << "." << std::endl;
-			return(1);
-		}
-		if (!doc2.loadXML(argv[optind + 1])) {
-			std::cerr << "Could not load: " << argv[2] << "." << std::endl;
-			return(1);
-		}
-		doc1.processXPath(xpath);
-		doc2.processXPath(xpath);
+		/* the deadline includes loading the documents */
+		DiffDijkstra::startClock();
+		/* all output writers reconstruct their output from the DOM */
+		Doc::loadPair(doc1, argv[optind], doc2, argv[optind + 1], xpath, true, cachedir);
 
 		DiffDijkstra	diff(doc1,doc2);
 
@@ -106,6 +185,23 @@ int main(int argc, char** argv) {
 		diff.run();
 
 		if (!diff.result) throw "Did not get a result, something is wrong.\n";
+		if (DiffDijkstra::beamWidth)
+			std::cerr << "Beam search of width " << DiffDijkstra::beamWidth
+				<< " reached cost " << diff.result->cost << std::endl;
+		if (DiffDijkstra::weight)
+			std::cerr << "Weighted search of weight " << DiffDijkstra::weight
+				<< " reached cost " << diff.result->cost << std::endl;
+		if (DiffDijkstra::threads > 1)
+			std::cerr << "Parallel search on " << DiffDijkstra::threads
+				<< " threads reached cost " << diff.result->cost << std::endl;
+		if (DiffDijkstra::deadline && !DiffDijkstra::fastApproximativeMode && !DiffDijkstra::beamWidth)
+			std::cerr << "Anytime search reached cost " << diff.result->cost << ", the result is "
+				<< (diff.optimal ? "" : "not ") << "proven "
+				<< (DiffDijkstra::weight ? "within the weight" : "optimal") << std::endl;
+		if (DiffDijkstra::queueLimit)
+			std::cerr << "Search evicted " << diff.evictedStates() << " states, the result is "
+				<< (diff.optimal ? "" : "not ") << "proven "
+				<< (DiffDijkstra::weight ? "within the weight" : "optimal") << std::endl;
 
 		switch (output) {
 		case 0:
@@ -18,6 +18,7 @@
 #include <map>
 
 #include "config.h"
+#include "arena.h"
 #include "rel_eqclass.h"
 #include "rel_count.h"
 
@@ -30,23 +31,85 @@ class Node;
 /** \brief Explicit notation is easier to read and easier to change */
 typedef vector<Node*>	NodeVec;
 
+/** \brief Fixed size list of nodes, pointing to memory owned by the document
+ *  (its arena or its relation graphs). The list is filled once, after the
+ *  number of entries is known. */
+class NodeList {
+public:
+	/** \brief iterator type, compatible to NodeVec iteration */
+	typedef Node** iterator;
+	/** \brief const iterator type */
+	typedef Node* const* const_iterator;
+	/** \brief list entries */
+	Node**		items;
+	/** \brief number of entries */
+	unsigned int	count;
+
+	/** \brief make an empty list */
+	NodeList() : items(NULL), count(0) {};
+	/** \brief allocate space for n entries from an arena
+	 *  \param arena arena to allocate from
+	 *  \param n number of entries */
+	void reserve(Arena& arena, unsigned int n) {
+		items = n ? (Node**) arena.alloc(n * sizeof(Node*)) : NULL;
+		count = 0;
+	}
+	/** \brief copy the contents of a vector into the arena
+	 *  \param arena arena to allocate from
+	 *  \param vec nodes to be copied */
+	void assign(Arena& arena, const NodeVec& vec) {
+		reserve(arena, vec.size());
+		for (NodeVec::const_iterator i = vec.begin(); i != vec.end(); ++i)
+			items[count++] = *i;
+	}
+	/** \brief first entry */
+	iterator begin() const { return items; }
+	/** \brief end of list */
+	iterator end() const { return items + count; }
+	/** \brief number of entries */
+	unsigned int size() const { return count; }
+	/** \brief test for empty list */
+	bool empty() const { return count == 0; }
+};
+
 /** \brief Class encapsulating a single node
  *  this is an abstraction layer away from the libxml data structure
- *  while allowing at the same time storage of additional information */
+ *  while allowing at the same time storage of additional information.
+ *
+ *  Nodes are allocated from the arena of their document and released
+ *  with it at once, so no destructor is run. */
 class Node {
 public:
+	/** \brief kind of document node */
+	enum Type {
+		/** \brief element node, label set */
+		ELEMENT,
+		/** \brief text node, content set */
+		TEXT,
+		/** \brief attribute node, label and content set */
+		ATTRIBUTE
+	};
 	/** \brief node label (for elements and attributes) */
 	ustring		label;
 	/** \brief node content (for text nodes and attributes) */
 	ustring		content;
-	/** \brief nodes related to this in "upward" direction */
-	NodeVec*	relup;
-	/** \brief nodes related to this in "down" direction */
-	NodeVec*	reldown;
+	/** \brief position in the node list of the document (document order)
+	 *  the related nodes are found in the documents relation graphs by id */
+	unsigned int	id;
+	/** \brief id of the last node in the subtree of this node, so the
+	 *  descendants are exactly the nodes with ids in (id, last] */
+	unsigned int	last;
+	/** \brief position in the children list of the parent */
+	unsigned int	pos;
+	/** \brief structural hash of the subtree, see Doc::hashSubtrees() */
+	uint64_t	treehash;
 	/** \brief document tree children of this node */
-	NodeVec*	children;
+	NodeList	children;
 	/** \brief document tree parent of this node */
 	Node*		parent;
+	/** \brief kind of node, attributes are kept in the children list
+	 *  but are not children in the XPath sense */
+	Type		type;
 
 	/** \brief additional data (for example underlying libxml node) */
 	void*		data;
@@ -54,16 +117,12 @@ public:
 	 *  \param l Label of the node
 	 *  \param c Text content of the node
 	 *  \param par Parent node
+	 *  \param t Kind of node
 	 *  \param d Additional data (for example underlying libxml node) */
-	Node(ustring l, ustring c, Node* par, void* d) :
-		label(l), content(c),
-		relup(NULL), reldown(NULL),
-		children(NULL), parent(par), data(d)
+	Node(ustring l, ustring c, Node* par, Type t, void* d) :
+		label(l), content(c), id(0), last(0), pos(0), treehash(0),
+		parent(par), type(t), data(d)
 		{};
-	/** \brief add a child to the nodes child list */
-	void addChild(Node* node);
-	/** \brief free node structure */
-	~Node();
 
 	/** \brief print node information to stream
 	 *  \param st stream to append to
@@ -38,36 +38,36 @@ public:
 	 * \param n node to calculate the clayss for */
 	NodeEqClass(Node& n);
 
+	/** \brief both string ids packed into a single 64 bit key
+	 * \return key, label id in the upper half */
+	uint64_t key() const {
+		return ((uint64_t) label.id() << 32) | content.id();
+	}
+
 	/** \brief ordering needed for sorted maps
 	 * 
-	 * Since this uses the ustring order, which is a memory order
-	 * the sequence will vary from run to run. This randomization
-	 * should give good performance on average, too.
+	 * Since this uses the ustring order, which is the order of
+	 * first occurrence of the strings, the sequence is the same
+	 * on every run.
 	 * \param r2 node equality class to compare to
 	 * \return comparison result
 	 * */
 	bool operator<(const NodeEqClass r2) const {
-		if (label != r2.label) return label < r2.label;
-		return content < r2.content;
+		return key() < r2.key();
 	}
 	/** \brief test equality of two classes
 	 * \param r2 nodeeqclass to compare to
 	 * \return comparison result
 	 * */
 	bool operator==(const NodeEqClass r2) const {
-		return (label == r2.label) && (content == r2.content);
+		return key() == r2.key();
 	}
 
 	/** \brief hash function for equality classes
-	 * this uses the string hash function, which supposedly is
-	 * very efficient, being the pointer of the strings themselves
+	 * mixes the packed key of both string ids
 	 * \return hash value
 	 * */
-	size_t hash() const {
-		size_t h2 = content.hash();
-		/* avoid certain typical patterns that can occur when
-		 * using a 1:1 XOR */
-		return label.hash() ^ (h2 << 16) ^ (h2 >> 16); }
+	size_t hash() const { return mix64(key()); }
 
 	/** \brief serialization to output streams
 	 * \param out output stream
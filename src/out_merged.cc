@@ -136,7 +136,9 @@ void MergedWriter::diffAttributes(
 	hashmap<xmlNodePtr, xmlNodePtr, hashfun<void*> >::iterator i;
 	xmlAttrPtr a1, a2;
 	xmlNodePtr remattr = NULL;
-	if (p1)
+	/* only elements have attributes; the reader stores short text
+	 * contents in the properties field of text nodes */
+	if (p1 && p1->type == XML_ELEMENT_NODE)
 	for (a1 = p1->properties; a1; a1 = a1->next) {
 		i = map.find((xmlNodePtr)a1);
 		if (i != map.end()) {
@@ -187,7 +189,7 @@ void MergedWriter::diffAttributes(
 			}
 		}
 	}
-	if (p2)
+	if (p2 && p2->type == XML_ELEMENT_NODE)
 	for (a2 = p2->properties; a2; a2 = a2->next) {
 		i = map.find((xmlNodePtr)a2);
 		if (i != map.end()) {
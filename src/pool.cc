@@ -0,0 +1,22 @@
+/* ===========================================================================
+ *        Filename:  pool.cc
+ *     Description:  Free list allocator for objects of a few sizes
+ *
+ *         Version:  $Rev$
+ *         Changed:  $Date$
+ *         Licence:  GPL (read COPYING file for details)
+ *
+ *          Author:  Erich Schubert (eS), erich@debian.org
+ *                   Institut für Informatik, LMU München
+ * ======================================================================== */
+#include "pool.h"
+
+namespace SSD {
+
+void
+MemoryPool::reset() {
+	freelists.clear();
+	arena.release();
+}
+
+}
@@ -0,0 +1,87 @@
+/* ===========================================================================
+ *        Filename:  pool.h
+ *     Description:  Free list allocator for objects of a few sizes
+ *
+ *         Version:  $Rev$
+ *         Changed:  $Date$
+ *         Licence:  GPL (read COPYING file for details)
+ *
+ *          Author:  Erich Schubert (eS), erich@debian.org
+ *                   Institut für Informatik, LMU München
+ * ======================================================================== */
+#ifndef  SSD_POOL_H
+#define  SSD_POOL_H
+
+#include "config.h"
+#include "arena.h"
+#include <cstddef>
+#include <vector>
+
+namespace SSD {
+
+/* allocation granularity of the pool, also the smallest object size */
+#define POOL_GRANULE sizeof(void*)
+
+/** \brief Allocator for objects that are created and destroyed frequently
+ *
+ *  Requests are rounded up to a multiple of the pointer size. There is one
+ *  free list for each such size class; freed objects are put on the list
+ *  of their class and handed out again by the next request of that size.
+ *  New memory is taken from an arena, so nothing is returned to the system
+ *  until reset() is called or the pool is destroyed.
+ *
+ *  The caller has to pass the size of an object when freeing it. No
+ *  constructors or destructors are run by the pool. */
+class MemoryPool {
+private:
+	/** \brief free object, linked into the list of its size class */
+	struct FreeObject {
+		/** \brief next free object of the same class */
+		FreeObject*	next;
+	};
+	/** \brief free lists, indexed by size class */
+	std::vector<FreeObject*>	freelists;
+	/** \brief storage for the objects */
+	Arena	arena;
+
+	/** \brief size class of a request
+	 *  \param n size in bytes */
+	static size_t sizeClass(size_t n) { return n ? (n + POOL_GRANULE - 1) / POOL_GRANULE : 1; }
+	/** \brief no copying, the pool owns its memory */
+	MemoryPool(const MemoryPool&);
+	/** \brief no copying, the pool owns its memory */
+	MemoryPool& operator=(const MemoryPool&);
+public:
+	/** \brief make an empty pool */
+	MemoryPool() {};
+	/** \brief allocate uninitialized memory
+	 *  \param n number of bytes needed
+	 *  \return pointer to the memory, never NULL */
+	void* alloc(size_t n) {
+		size_t c = sizeClass(n);
+		if (c < freelists.size() && freelists[c]) {
+			FreeObject* o = freelists[c];
+			freelists[c] = o->next;
+			return o;
+		}
+		return arena.alloc(c * POOL_GRANULE);
+	}
+	/** \brief put memory back for reuse
+	 *  \param p memory returned by alloc(), may be NULL
+	 *  \param n size passed to alloc() */
+	void free(void* p, size_t n) {
+		if (!p) return;
+		size_t c = sizeClass(n);
+		if (c >= freelists.size()) freelists.resize(c + 1, NULL);
+		FreeObject* o = (FreeObject*) p;
+		o->next = freelists[c];
+		freelists[c] = o;
+	}
+	/** \brief release all memory at once, whether freed or not */
+	void reset();
+	/** \brief number of bytes reserved from the system */
+	size_t bytes() const { return arena.bytes(); }
+};
+
+}
+#endif   /* ----- #ifndef SSD_POOL_H  ----- */
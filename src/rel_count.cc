@@ -11,6 +11,7 @@
  * ======================================================================== */
 #include "rel_count.h"
 #include <utility> /* for make_pair */
+#include <algorithm>
 
 namespace SSD {
 
@@ -18,7 +19,7 @@ namespace SSD {
 unsigned int RelCount::len = 0;
 hashmap<RelEqClass, unsigned int, hash_releqc> RelCount::cmap;
 
-RelCount::RelCount(hashmap<RelEqClass, int, hash_releqc>& map1, hashmap<RelEqClass, int, hash_releqc>& map2) : data(NULL) {
+RelCount::RelCount(hashmap<RelEqClass, int, hash_releqc>& map1, hashmap<RelEqClass, int, hash_releqc>& map2) : data(NULL), position(NULL) {
 	hashmap<RelEqClass, int, hash_releqc>::iterator i1, i2;
 	vector<short> tmpdata;
 	
@@ -55,14 +56,14 @@ RelCount::RelCount(hashmap<RelEqClass, int, hash_releqc>& map1, hashmap<RelEqCla
 		data[i] = tmpdata[i] * 2;
 }
 
-RelCount::RelCount(RelCount& rc) : data(NULL) {
+RelCount::RelCount(RelCount& rc) : data(NULL), position(NULL) {
 	if (len > 0 && rc.data) {
 		data = (short*) calloc(len, sizeof(short));
 		memcpy(data, rc.data, sizeof(short)*len);
 	}
 }
 
-RelCount::RelCount() : data(NULL) {
+RelCount::RelCount() : data(NULL), position(NULL) {
 	if (len > 0) {
 		data = (short*) calloc(len, sizeof(short));
 	}
@@ -72,45 +73,121 @@ RelCount::~RelCount() {
 	if (data) { free(data); data=NULL; }
 }
 
+unsigned int RelCount::slot(const RelEqClass& key) {
+	/* find the key in lookup table */
+	hashmap<RelEqClass, unsigned int, hash_releqc>::iterator pos = cmap.find(key);
+	if (pos == cmap.end())
+		throw "New key encountered during 'modify'.";
+	return pos->second;
+}
+
 int RelCount::modify(RelEqClass key, short val) {
+	return modify(slot(key), val);
+}
+
+int RelCount::modify(unsigned int slot, short val) {
 	int cost=0;
 
-	/* find the key in lookup table */
-	hashmap<RelEqClass, unsigned int, hash_releqc>::iterator pos = cmap.find(key);
-	if (pos != cmap.end()) {
-		/* unique keys don't generate costs */
-		if (pos->second == RELCOUNT_UNIQUE) return 0;
-		/* key occuring once each have a cost of 1 if dropped from the first document */
-		/* TODO: can it happen that we know first we'll drop it in the
-		 * second document? likely? then we should assign costs early in
-		 * that case somehow, too! Bitset? */
-		if (pos->second == RELCOUNT_ONCE)   return (val > 0) ? 1 : 0;
+	/* unique keys don't generate costs */
+	if (slot == RELCOUNT_UNIQUE) return 0;
+	/* key occuring once each have a cost of 1 if dropped from the first document */
+	/* TODO: can it happen that we know first we'll drop it in the
+	 * second document? likely? then we should assign costs early in
+	 * that case somehow, too! Bitset? */
+	if (slot == RELCOUNT_ONCE)   return (val > 0) ? 1 : 0;
 #ifdef CAREFUL
-		if (pos->second >= len)
-			throw "pos->second out of range in RelCount::modify";
+	if (slot >= len)
+		throw "slot out of range in RelCount::modify";
 #endif
 
-		int oldval = data[pos->second];
-		int newval = oldval - val;
-		data[pos->second] = newval;
-
-		/* calculate costs */
-		if (oldval > 0) {
-			if (   val < 0) cost += -val;
-			if (newval < 0) cost += -newval;
-		} else
-		if (oldval < 0) {
-			if (   val > 0) cost += val;
-			if (newval > 0) cost += newval;
-		} else
-		/* if (oldval == 0) */ {
-			cost = abs(val); /* == abs(newval) */
-		}
+	int oldval = data[slot];
+	int newval = oldval - val;
+	data[slot] = newval;
+	RelCountChange c = { slot, (short) oldval, (short) newval };
+	log.push_back(c);
+
+	/* calculate costs */
+	if (oldval > 0) {
+		if (   val < 0) cost += -val;
+		if (newval < 0) cost += -newval;
 	} else
-		throw "New key encountered during 'modify'.";
+	if (oldval < 0) {
+		if (   val > 0) cost += val;
+		if (newval > 0) cost += newval;
+	} else
+	/* if (oldval == 0) */ {
+		cost = abs(val); /* == abs(newval) */
+	}
 	return cost;
 }
 
+void RelCount::undo(const RelCountDelta* d) {
+	for (unsigned int i = d->count; i-- > 0; )
+		data[d->changes[i].slot] = d->changes[i].oldval;
+}
+
+void RelCount::redo(const RelCountDelta* d) {
+	for (unsigned int i = 0; i < d->count; i++)
+		data[d->changes[i].slot] = d->changes[i].newval;
+}
+
+void RelCount::rollback() {
+	for (unsigned int i = log.size(); i-- > 0; )
+		data[log[i].slot] = log[i].oldval;
+	log.clear();
+}
+
+void RelCount::moveTo(RelCountDelta* d, MemoryPool& pool) {
+	/* drop uncommitted changes */
+	rollback();
+	if (d == position) return;
+
+	/* undo up to the common ancestor, remembering the way down */
+	RelCountDelta* a = position;
+	RelCountDelta* b = d;
+	path.clear();
+	while (a && (!b || a->depth > b->depth)) { undo(a); a = a->parent; }
+	while (b && (!a || b->depth > a->depth)) { path.push_back(b); b = b->parent; }
+	while (a != b) {
+		undo(a); a = a->parent;
+		path.push_back(b); b = b->parent;
+	}
+	for (unsigned int i = path.size(); i-- > 0; )
+		redo(path[i]);
+
+	if (d) REF_INC(d->refcount);
+	RelCountDelta::release(position, pool);
+	position = d;
+}
+
+RelCountDelta* RelCount::commit(MemoryPool& pool) {
+	if (log.empty()) {
+		if (position) REF_INC(position->refcount);
+		return position;
+	}
+	unsigned int n = log.size();
+	RelCountDelta* d = (RelCountDelta*) pool.alloc(sizeof(RelCountDelta) + (n - 1) * sizeof(RelCountChange));
+	d->refcount = 1;
+	d->depth = position ? position->depth + 1 : 1;
+	d->parent = position;
+	if (position) REF_INC(position->refcount);
+	d->count = n;
+	for (unsigned int i = 0; i < n; i++)
+		d->changes[i] = log[i];
+	/* back to the values of the current position */
+	undo(d);
+	log.clear();
+	return d;
+}
+
+void RelCountDelta::release(RelCountDelta* d, MemoryPool& pool) {
+	while (d && REF_DEC(d->refcount) == 0) {
+		RelCountDelta* parent = d->parent;
+		pool.free(d, sizeof(RelCountDelta) + (d->count - 1) * sizeof(RelCountChange));
+		d = parent;
+	}
+}
+
 void RelCount::operator+=(const RelCount& other) {
 	for (unsigned int i=0; i<len; i++)
 		data[i] += other.data[i];
@@ -137,6 +214,16 @@ void RelCount::dumpIndex(std::ostream &out) {
 	}
 }
 
+void RelCount::reset() {
+	cmap.clear();
+	len = 0;
+}
+
+void RelCount::swapIndex(hashmap<RelEqClass, unsigned int, hash_releqc>& saved, unsigned int& savedLen) {
+	cmap.swap(saved);
+	std::swap(len, savedLen);
+}
+
 int RelCount::calc_max_retained(hashmap<RelEqClass, int, hash_releqc>& map1, hashmap<RelEqClass, int, hash_releqc>& map2) {
 	hashmap<RelEqClass, int, hash_releqc>::iterator i1, i2;
 	int max_retained=0;
@@ -13,6 +13,7 @@
 #define  SSD_REL_COUNT_H
 #include "config.h"
 #include "rel_eqclass.h"
+#include "pool.h"
 #include <vector>
 #include <climits>
 
@@ -23,6 +24,39 @@ namespace SSD {
 #define RELCOUNT_UNIQUE (UINT_MAX - 1)
 #define RELCOUNT_ONCE   (UINT_MAX - 2)
 
+/** \brief one change of a value in a RelCount */
+struct RelCountChange {
+	/** \brief index of the value */
+	unsigned int	slot;
+	/** \brief value before the change */
+	short		oldval;
+	/** \brief value after the change */
+	short		newval;
+};
+
+/** \brief persistent set of changes to a RelCount, relative to a parent set
+ *
+ *  The chain of parents leads back to the initial values of the RelCount
+ *  (the NULL delta). Deltas are reference counted like NodeAssignments,
+ *  each delta holding a reference to its parent. */
+struct RelCountDelta {
+	/** \brief number of states, deltas and RelCounts referring to this */
+	unsigned int	refcount;
+	/** \brief length of the parent chain */
+	unsigned int	depth;
+	/** \brief delta these changes apply to, NULL for the initial values */
+	RelCountDelta*	parent;
+	/** \brief number of changes */
+	unsigned int	count;
+	/** \brief changes, in the order they were made; allocated with the delta */
+	RelCountChange	changes[1];
+
+	/** \brief drop a reference, freeing deltas no longer referred to
+	 *  \param d delta, may be NULL
+	 *  \param pool pool the deltas were taken from */
+	static void release(RelCountDelta* d, MemoryPool& pool);
+};
+
 /** \brief relation count class */
 /** This class plays an essential role in the improved cost functions.
  *  To find out more about its use, read the algorithm whitepapers.
@@ -40,6 +74,12 @@ namespace SSD {
  *  Also we do not store entries for the case that there is only one
  *  relation of this class at most in one document. Then we can use this
  *  as indicator if we have already lost it or not directly.
+ *
+ *  The search does not copy the values for each state. Each state keeps a
+ *  RelCountDelta with just the values changed by its last match, and a
+ *  single RelCount is moved between states with moveTo(), which undoes
+ *  and redoes the changes along the chains of deltas. Changes made by
+ *  modify() are collected and turned into a new delta by commit().
  */
 class RelCount {
 private:
@@ -49,12 +89,23 @@ private:
 	static hashmap<RelEqClass, unsigned int, hash_releqc> cmap;
 	/** \brief data storage. would be interesting to save the memory for this pointer, too... */
 	short*	data;
+	/** \brief delta the current values correspond to, not counting the log */
+	RelCountDelta*	position;
+	/** \brief changes made by modify() since the last move or commit */
+	vector<RelCountChange>	log;
+	/** \brief scratch space for moveTo() */
+	vector<RelCountDelta*>	path;
+	/** \brief revert the changes of a delta, going to its parent */
+	void undo(const RelCountDelta* d);
+	/** \brief apply the changes of a delta, coming from its parent */
+	void redo(const RelCountDelta* d);
 public:
 	/** \brief make an empty RelCount */
 	RelCount();
 	/** \brief make an initial RelCount by making the difference between two maps */
 	/** this will initialize the static cmap used as hash. Never process two diffs at the same time!
 	 *  Always use this once and make this the first RelCount object you create!
+	 *  The index belongs to the active DiffSession and ends with it.
 	 *  \param map1 relation counts in first document
 	 *  \param map2 relation counts in second document */
 	RelCount(hashmap<RelEqClass, int, hash_releqc>& map1, hashmap<RelEqClass, int, hash_releqc>& map2);
@@ -62,6 +113,27 @@ public:
 	RelCount(RelCount& rc);
 	/** \brief delete a RelCount dataset */
 	~RelCount();
+	/** \brief bring the values to those of another delta
+	 *
+	 *  changes not yet committed are lost. The RelCount keeps a reference
+	 *  to the delta; move to NULL before destroying the RelCount.
+	 *  \param d target delta, NULL for the initial values
+	 *  \param pool pool the deltas were taken from */
+	void moveTo(RelCountDelta* d, MemoryPool& pool);
+	/** \brief undo the changes since the last move or commit */
+	void rollback();
+	/** \brief keep the changes since the last move or commit without a delta
+	 *
+	 *  the values then no longer correspond to the current delta, so this
+	 *  is only for a search that never goes back to an earlier state. */
+	void accept() { log.clear(); }
+	/** \brief turn the changes since the last move or commit into a delta
+	 *
+	 *  the changes are undone afterwards, so further changes start from
+	 *  the same values again. Without changes, the current delta is shared.
+	 *  \param pool pool to take the delta from
+	 *  \return new delta, with one reference for the caller */
+	RelCountDelta* commit(MemoryPool& pool);
 	/** \brief add a RelCount dataset to this set */
 	/** \param other dataset to be added */
 	void operator+=(const RelCount& other);
@@ -73,6 +145,17 @@ public:
 	 *  \param val relative change to be done
 	 *  \return costs caused */
 	int  modify(RelEqClass key, short val);
+	/** \brief modify a single value in the dataset */
+	/** \param slot slot of the relation class to be updated, see slot()
+	 *  \param val relative change to be done
+	 *  \return costs caused */
+	int  modify(unsigned int slot, short val);
+	/** \brief find the slot of a relation class
+	 *
+	 *  slots stay valid until reset() is called.
+	 *  \param key relation class
+	 *  \return index into the values, or RELCOUNT_UNIQUE or RELCOUNT_ONCE */
+	static unsigned int slot(const RelEqClass& key);
 	/* for debug output */
 	/** \brief append to an output stream */
 	/** \param out output stream to be appended to
@@ -81,6 +164,15 @@ public:
 	/** \brief dumping helper */
 	/** \param out stream to be dumped to */
 	static void dumpIndex(std::ostream &out);
+	/** \brief drop the class index, so a new diff can be initialized */
+	static void reset();
+	/** \brief exchange the class index with a saved one
+	 *
+	 *  lets a DiffSession start with an empty index and give the one of
+	 *  the session before it back when it ends.
+	 *  \param saved saved class index
+	 *  \param savedLen number of slots of the saved index */
+	static void swapIndex(hashmap<RelEqClass, unsigned int, hash_releqc>& saved, unsigned int& savedLen);
 	/** \brief calc maximum retaintable prediction
 	 *  \param map1 relation counts in first document
 	 *  \param map2 relation counts in second document */
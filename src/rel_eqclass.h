@@ -26,9 +26,9 @@ class RelEqClass {
 	ustring fl;
 	/** \brief first content */
 	ustring fc;
-	/** \brief first label   */
+	/** \brief second label  */
 	ustring sl;
-	/** \brief first content */
+	/** \brief second content */
 	ustring sc;
 public:
 	/** \brief get class for two nodes by reference */
@@ -48,26 +48,48 @@ public:
 	 *  \param n2 node */
 	RelEqClass(const NodeEqClass& n1, const Node& n2);
 
+	/** \brief get class from the strings of both nodes */
+	/** \param l1 first label
+	 *  \param c1 first content
+	 *  \param l2 second label
+	 *  \param c2 second content */
+	RelEqClass(ustring l1, ustring c1, ustring l2, ustring c2)
+	: fl(l1), fc(c1), sl(l2), sc(c2) { }
+
+	/** \brief first label */
+	ustring firstLabel() const { return fl; }
+	/** \brief first content */
+	ustring firstContent() const { return fc; }
+	/** \brief second label */
+	ustring secondLabel() const { return sl; }
+	/** \brief second content */
+	ustring secondContent() const { return sc; }
+
+	/** \brief first node class as packed 64 bit key */
+	uint64_t firstKey() const {
+		return ((uint64_t) fl.id() << 32) | fc.id();
+	}
+	/** \brief second node class as packed 64 bit key */
+	uint64_t secondKey() const {
+		return ((uint64_t) sl.id() << 32) | sc.id();
+	}
+
 	/** \brief strict weak ordering for sorted maps */
 	/** \param r2 class to be compared with */
 	bool operator<(const RelEqClass r2) const {
-		if (fl != r2.fl) return fl < r2.fl;
-		if (fc != r2.fc) return fc < r2.fc;
-		if (sl != r2.sl) return sl < r2.sl;
-		                 return sc < r2.sc;
+		if (firstKey() != r2.firstKey()) return firstKey() < r2.firstKey();
+		return secondKey() < r2.secondKey();
 	}
 	/** \brief test for equality */
 	/** \param r2 class to be compared with */
 	bool operator==(const RelEqClass r2) const {
-		return (fl == r2.fl) && (fc == r2.fc) && (sl == r2.sl) && (sc == r2.sc);
+		return (firstKey() == r2.firstKey()) && (secondKey() == r2.secondKey());
 	}
 
-	/** \brief hash function for maps */
+	/** \brief hash function for maps, mixing the 128 bit key */
 	size_t hash() const {
-		size_t h2 = fc.hash();
-		size_t h3 = sl.hash();
-		size_t h4 = sc.hash();
-		return fl.hash() ^ (h2 << 16) ^ (h2 >> 16) ^ (h3 << 8) ^ (h3 >> 24) ^ (h4 << 24) ^ (h4 >> 8); }
+		return mix64(firstKey() ^ mix64(secondKey()));
+	}
 
 	/** \brief helper function to allow dumping onto output streams */
 	/** \param out output stream to be written to
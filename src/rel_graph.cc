@@ -0,0 +1,105 @@
+/* ===========================================================================
+ *        Filename:  rel_graph.cc
+ *     Description:  Relation graph in compressed sparse row format
+ *
+ *         Version:  $Rev$
+ *         Changed:  $Date$
+ *         Licence:  GPL (read COPYING file for details)
+ *
+ *          Author:  Erich Schubert (eS), erich@debian.org
+ *                   Institut für Informatik, LMU München
+ * ======================================================================== */
+#include "rel_graph.h"
+#include "rel_count.h"
+#include <algorithm>
+
+namespace SSD {
+
+void
+RelGraph::transpose(const RelGraph& other, const NodeVec& nodes) {
+	unsigned int n = nodes.size();
+	/* count the incoming relations of each node */
+	offset.assign(n + 1, 0);
+	for (vector<Node*>::const_iterator i = other.target.begin(); i != other.target.end(); ++i)
+		offset[(*i)->id + 1]++;
+	for (unsigned int i = 0; i < n; i++)
+		offset[i + 1] += offset[i];
+
+	/* fill by increasing source id, so each list is in document order */
+	vector<unsigned int> pos(offset.begin(), offset.end() - 1);
+	target.resize(other.target.size());
+	for (unsigned int src = 0; src < n && src + 1 < other.offset.size(); src++)
+		for (unsigned int i = other.offset[src]; i < other.offset[src + 1]; i++)
+			target[pos[other.target[i]->id]++] = nodes[src];
+}
+
+void
+RelGraph::allocate(unsigned int n, size_t edges) {
+	clear();
+	offset.resize(n + 1);
+	offset[n] = edges;
+	target.resize(edges);
+}
+
+void
+RelGraph::fill(unsigned int first, size_t at, const RelGraph& part) {
+	for (unsigned int i = 0; i + 1 < part.offset.size(); i++)
+		offset[first + i] = at + part.offset[i];
+	copy(part.target.begin(), part.target.end(), target.begin() + at);
+}
+
+void
+RelGraph::setImplicit(Kind k, const NodeVec& nodes, unsigned int t) {
+	clear();
+	kind = k;
+	types = t;
+	base = nodes.empty() ? NULL : &nodes[0];
+}
+
+void
+RelGraph::annotate(const NodeVec& nodes, bool up) {
+	slot.clear();
+	if (implicit()) return;
+	slot.resize(target.size());
+	for (unsigned int src = 0; src < nodes.size() && src + 1 < offset.size(); src++)
+		for (unsigned int i = offset[src]; i < offset[src + 1]; i++)
+			slot[i] = up ? RelCount::slot(RelEqClass(target[i], nodes[src]))
+				: RelCount::slot(RelEqClass(nodes[src], target[i]));
+}
+
+RelList
+RelGraph::operator[](const Node* n) const {
+	RelList l;
+	switch (kind) {
+	case DESCENDANT:
+		/* attributes are not descendants; for them, last == id */
+		l.items = base + n->id + 1;
+		l.stop = base + n->last + 1;
+		l.types = REL_NONATTR;
+		break;
+	case ANCESTOR:
+		if (n->type != Node::ATTRIBUTE) l.chain = n->parent;
+		break;
+	case FOLLOWING_SIBLING:
+		if (n->type == Node::ATTRIBUTE || !n->parent) break;
+		l.items = n->parent->children.begin() + n->pos + 1;
+		l.stop = n->parent->children.end();
+		l.types = types;
+		break;
+	case PRECEDING_SIBLING:
+		if (!(types & typeBit(n->type)) || !n->parent) break;
+		l.items = n->parent->children.begin();
+		l.stop = l.items + n->pos;
+		l.types = REL_NONATTR;
+		break;
+	default:
+		if (n->id + 1 < offset.size() && offset[n->id] < offset[n->id + 1]) {
+			l.items = &target[offset[n->id]];
+			l.stop = l.items + (offset[n->id + 1] - offset[n->id]);
+			if (!slot.empty()) l.slots = &slot[offset[n->id]];
+		}
+	}
+	return l;
+}
+
+}
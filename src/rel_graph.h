@@ -0,0 +1,208 @@
+/* ===========================================================================
+ *        Filename:  rel_graph.h
+ *     Description:  Relation graph in compressed sparse row format
+ *
+ *         Version:  $Rev$
+ *         Changed:  $Date$
+ *         Licence:  GPL (read COPYING file for details)
+ *
+ *          Author:  Erich Schubert (eS), erich@debian.org
+ *                   Institut für Informatik, LMU München
+ * ======================================================================== */
+#ifndef  SSD_REL_GRAPH_H
+#define  SSD_REL_GRAPH_H
+
+#include "config.h"
+#include "node.h"
+
+#include <vector>
+
+using namespace std;
+
+namespace SSD {
+
+/** \brief Bit for a node type in a type mask
+ *  \param t node type
+ *  \return mask with the bit for this type set */
+inline unsigned int typeBit(Node::Type t) { return 1u << t; }
+
+/** \brief mask matching the nodes of the XPath child axis */
+#define REL_NONATTR (typeBit(Node::ELEMENT) | typeBit(Node::TEXT))
+/** \brief mask matching every node */
+#define REL_ANYTYPE (REL_NONATTR | typeBit(Node::ATTRIBUTE))
+
+/** \brief Related nodes of a single node
+ *
+ *  Either a range of consecutive node pointers, of which only the nodes
+ *  with a type in the given mask are used, or the chain of ancestors of
+ *  a node. Both point into data owned by the document. */
+class RelList {
+public:
+	/** \brief forward iterator over the related nodes */
+	class iterator {
+	private:
+		/** \brief position in the range */
+		Node* const*	pos;
+		/** \brief end of the range */
+		Node* const*	stop;
+		/** \brief current ancestor, when walking the parent chain */
+		Node*		chain;
+		/** \brief node types to be used from the range */
+		unsigned int	types;
+		/** \brief RelCount slot of the current relation, NULL if not annotated */
+		const unsigned int*	spos;
+		/** \brief advance to the next node of a wanted type */
+		void skip() {
+			while (pos != stop && !(types & typeBit((*pos)->type))) { ++pos; if (spos) ++spos; }
+		}
+	public:
+		/** \brief make an iterator
+		 *  \param p start of range
+		 *  \param e end of range
+		 *  \param c first ancestor, NULL for ranges
+		 *  \param t node type mask
+		 *  \param s slots of the range, NULL if not annotated */
+		iterator(Node* const* p = NULL, Node* const* e = NULL, Node* c = NULL, unsigned int t = REL_ANYTYPE,
+				const unsigned int* s = NULL) :
+			pos(p), stop(e), chain(c), types(t), spos(s) { skip(); }
+		/** \brief current node */
+		Node* operator*() const { return chain ? chain : *pos; }
+		/** \brief advance to the next node */
+		iterator& operator++() {
+			if (chain) chain = chain->parent; else { ++pos; if (spos) ++spos; skip(); }
+			return *this;
+		}
+		/** \brief advance to the next node */
+		iterator operator++(int) { iterator old = *this; ++*this; return old; }
+		/** \brief test if the RelCount slot of the relation is known */
+		bool annotated() const { return spos != NULL; }
+		/** \brief RelCount slot of the current relation, see RelGraph::annotate() */
+		unsigned int slot() const { return *spos; }
+		/** \brief compare iterators */
+		bool operator==(const iterator& o) const { return pos == o.pos && chain == o.chain; }
+		/** \brief compare iterators */
+		bool operator!=(const iterator& o) const { return !(*this == o); }
+	};
+	/** \brief start of range */
+	Node* const*	items;
+	/** \brief end of range */
+	Node* const*	stop;
+	/** \brief first ancestor for parent chains */
+	Node*		chain;
+	/** \brief node types to be used from the range */
+	unsigned int	types;
+	/** \brief RelCount slots of the range, NULL if not annotated */
+	const unsigned int*	slots;
+
+	/** \brief make an empty list */
+	RelList() : items(NULL), stop(NULL), chain(NULL), types(REL_ANYTYPE), slots(NULL) {};
+	/** \brief first entry */
+	iterator begin() const { return iterator(items, stop, chain, types, slots); }
+	/** \brief end of list */
+	iterator end() const { return iterator(stop, stop, NULL, types); }
+};
+
+/** \brief Relations of one direction for all nodes of a document
+ *
+ *  Explicit relations are stored in one contiguous array, ordered by node
+ *  id, with an offset array pointing to the start of the list of each node
+ *  (compressed sparse row format). Iterating over the relations of a node
+ *  thus reads consecutive memory. The graph is built once, in increasing
+ *  order of node ids, and is read-only afterwards.
+ *
+ *  The transitive descendant and sibling order relations would need a
+ *  quadratic number of edges, so they are not stored but derived from
+ *  the interval numbering of the nodes: the descendants of a node are the
+ *  nodes with ids in (Node::id, Node::last], its following siblings are
+ *  the entries after Node::pos in the children list of its parent.
+ *
+ *  Stored edges can be annotated with the RelCount slot of their relation
+ *  class, so the search does not need to look up the class of each edge. */
+class RelGraph {
+public:
+	/** \brief how the relations are represented */
+	enum Kind {
+		/** \brief stored edges */
+		EXPLICIT,
+		/** \brief descendants (XPath ".//node()") */
+		DESCENDANT,
+		/** \brief ancestors, reverse of DESCENDANT */
+		ANCESTOR,
+		/** \brief following siblings (XPath "following-sibling::node()") */
+		FOLLOWING_SIBLING,
+		/** \brief preceding siblings, reverse of FOLLOWING_SIBLING */
+		PRECEDING_SIBLING
+	};
+private:
+	/** \brief representation of the relations */
+	Kind			kind;
+	/** \brief node types in the forward sibling relation */
+	unsigned int		types;
+	/** \brief all nodes of the document by id, for implicit relations */
+	Node* const*		base;
+	/** \brief start of the list of each node, plus one final end entry */
+	vector<unsigned int>	offset;
+	/** \brief related nodes of all nodes */
+	vector<Node*>		target;
+	/** \brief RelCount slot of each relation, empty if not annotated */
+	vector<unsigned int>	slot;
+public:
+	/** \brief make an empty explicit graph */
+	RelGraph() : kind(EXPLICIT), types(REL_ANYTYPE), base(NULL) {};
+	/** \brief drop all relations, the graph is explicit afterwards */
+	void clear() { kind = EXPLICIT; types = REL_ANYTYPE; base = NULL; offset.clear(); target.clear(); slot.clear(); }
+	/** \brief start the list of a node; lists are added by increasing id
+	 *  \param id id of the node whose relations are added next */
+	void startNode(unsigned int id) {
+		while (offset.size() <= id) offset.push_back(target.size());
+	}
+	/** \brief add a relation to the list of the current node
+	 *  \param n related node */
+	void add(Node* n) { target.push_back(n); }
+	/** \brief close the graph
+	 *  \param n total number of nodes in the document */
+	void finish(unsigned int n) { startNode(n); }
+	/** \brief make room for a graph to be filled from parts
+	 *  \param n total number of nodes in the document
+	 *  \param edges total number of relations */
+	void allocate(unsigned int n, size_t edges);
+	/** \brief copy the relations of a range of nodes into an allocated graph
+	 *
+	 *  distinct ranges may be filled concurrently
+	 *  \param first id of the first node of the range
+	 *  \param at position of the first relation of the range
+	 *  \param part finished graph of the range, with ids relative to first */
+	void fill(unsigned int first, size_t at, const RelGraph& part);
+	/** \brief build the graph of the reverse direction
+	 *  \param other graph to be reversed, finished
+	 *  \param nodes all nodes of the document, by id */
+	void transpose(const RelGraph& other, const NodeVec& nodes);
+	/** \brief use an implicit relation instead of stored edges
+	 *  \param k kind of relation, not EXPLICIT
+	 *  \param nodes all nodes of the document, by id, with intervals set
+	 *  \param t node types related by the sibling relations */
+	void setImplicit(Kind k, const NodeVec& nodes, unsigned int t = REL_NONATTR);
+	/** \brief store the RelCount slot of each stored relation
+	 *
+	 *  the slot is that of the class (parent, child) of the relation, for
+	 *  graphs of both directions. Implicit graphs are not annotated. The
+	 *  RelCount index has to be set up for the current diff.
+	 *  \param nodes all nodes of the document, by id
+	 *  \param up true if this graph is the reverse direction */
+	void annotate(const NodeVec& nodes, bool up);
+	/** \brief representation of the relations */
+	Kind getKind() const { return kind; }
+	/** \brief node types in the forward sibling relation */
+	unsigned int getTypes() const { return types; }
+	/** \brief test for implicit relations, which are not stored */
+	bool implicit() const { return kind != EXPLICIT; }
+	/** \brief number of relations stored */
+	size_t edges() const { return target.size(); }
+	/** \brief relations of a node
+	 *  \param n node
+	 *  \return list of related nodes, pointing into the graph or document */
+	RelList operator[](const Node* n) const;
+};
+
+}
+#endif   /* ----- #ifndef SSD_REL_GRAPH_H  ----- */
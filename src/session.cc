@@ -0,0 +1,34 @@
+/* ===========================================================================
+ *        Filename:  session.cc
+ *     Description:  Diff session holding the interned strings
+ *
+ *         Version:  $Rev$
+ *         Changed:  $Date$
+ *         Licence:  GPL (read COPYING file for details)
+ *
+ *          Author:  Erich Schubert (eS), erich@debian.org
+ *                   Institut für Informatik, LMU München
+ * ======================================================================== */
+#include "session.h"
+#include "ustring.h"
+#include "rel_count.h"
+
+namespace SSD {
+
+DiffSession* DiffSession::active = NULL;
+
+DiffSession::DiffSession() : previous(active), classSlots(0) {
+	active = this;
+	ustring::setPool(&pool);
+	/* start with an empty relation class index, keeping the previous one */
+	RelCount::swapIndex(classes, classSlots);
+}
+
+DiffSession::~DiffSession() {
+	/* the relation class index refers to strings of this session */
+	RelCount::swapIndex(classes, classSlots);
+	active = previous;
+	ustring::setPool(previous ? &previous->pool : NULL);
+}
+
+}
@@ -0,0 +1,65 @@
+/* ===========================================================================
+ *        Filename:  session.h
+ *     Description:  Diff session holding the interned strings
+ *
+ *         Version:  $Rev$
+ *         Changed:  $Date$
+ *         Licence:  GPL (read COPYING file for details)
+ *
+ *          Author:  Erich Schubert (eS), erich@debian.org
+ *                   Institut für Informatik, LMU München
+ * ======================================================================== */
+#ifndef  SSD_SESSION_H
+#define  SSD_SESSION_H
+
+#include "config.h"
+#include "string_pool.h"
+#include "rel_count.h"
+
+
+namespace SSD {
+
+/** \brief Interning context for one diff
+ *
+ *  All ustrings created while a session is active are stored in the
+ *  session's string pool. Destroying the session releases all these
+ *  strings at once,
+ *  so a long running process can diff any number of document pairs
+ *  without accumulating strings.
+ *
+ *  The Doc objects and the DiffDijkstra search of a diff must be
+ *  destroyed before their session. Sessions may be nested, the previously
+ *  active session, with its strings and relation classes, is restored on
+ *  destruction. */
+class DiffSession {
+private:
+	/** \brief strings interned during this session */
+	StringPool	pool;
+	/** \brief session that was active before this one */
+	DiffSession*	previous;
+	/** \brief relation class index of the session before this one, see RelCount::swapIndex() */
+	hashmap<RelEqClass, unsigned int, hash_releqc>	classes;
+	/** \brief number of slots of that index */
+	unsigned int	classSlots;
+	/** \brief currently active session */
+	static DiffSession*	active;
+
+	/** \brief no copying */
+	DiffSession(const DiffSession&);
+	/** \brief no copying */
+	DiffSession& operator=(const DiffSession&);
+public:
+	/** \brief create a new session and make it the active one */
+	DiffSession();
+	/** \brief release all strings of this session */
+	~DiffSession();
+	/** \brief number of distinct strings interned in this session */
+	size_t poolStrings() const { return pool.size(); }
+	/** \brief number of bytes used by the string pool of this session */
+	size_t poolBytes() const { return pool.bytes(); }
+	/** \brief the currently active session, NULL if none */
+	static DiffSession* current() { return active; }
+};
+
+}
+#endif   /* ----- #ifndef SSD_SESSION_H  ----- */
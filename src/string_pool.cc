@@ -0,0 +1,103 @@
+/* ===========================================================================
+ *        Filename:  string_pool.cc
+ *     Description:  Interning table for unified strings
+ *
+ *         Version:  $Rev$
+ *         Changed:  $Date$
+ *         Licence:  GPL (read COPYING file for details)
+ *
+ *          Author:  Erich Schubert (eS), erich@debian.org
+ *                   Institut für Informatik, LMU München
+ * ======================================================================== */
+#include "string_pool.h"
+#include <cstdlib>
+#include <cstring>
+
+namespace SSD {
+
+#define STRINGPOOL_INITIAL 1024
+
+StringPool::StringPool() : table(NULL), mask(STRINGPOOL_INITIAL - 1), strings(1, (const char*) NULL) {
+	table = (Entry*) calloc(STRINGPOOL_INITIAL, sizeof(Entry));
+	if (!table) throw "StringPool - out of memory";
+	pthread_mutex_init(&lock, NULL);
+}
+
+StringPool::~StringPool() {
+	pthread_mutex_destroy(&lock);
+	free(table);
+}
+
+void
+StringPool::grow() {
+	size_t nmask = 2 * mask + 1;
+	Entry* ntable = (Entry*) calloc(nmask + 1, sizeof(Entry));
+	if (!ntable) throw "StringPool::grow - out of memory";
+	/* re-insert using the cached hash values */
+	for (size_t i = 0; i <= mask; i++) {
+		if (!table[i].id) continue;
+		size_t pos = table[i].hash & nmask;
+		while (ntable[pos].id) pos = (pos + 1) & nmask;
+		ntable[pos] = table[i];
+	}
+	free(table);
+	table = ntable;
+	mask = nmask;
+}
+
+unsigned int
+StringPool::intern(const char* s) {
+	size_t len;
+	size_t h = hash_cstr(s, &len);
+
+	pthread_mutex_lock(&lock);
+	size_t pos = h & mask;
+	while (table[pos].id) {
+		if (table[pos].hash == h && strcmp(strings[table[pos].id], s) == 0) {
+			unsigned int id = table[pos].id;
+			pthread_mutex_unlock(&lock);
+			return id;
+		}
+		pos = (pos + 1) & mask;
+	}
+
+	/* copy to arena */
+	char* str = (char*) arena.alloc(len + 1, 1);
+	memcpy(str, s, len + 1);
+
+	unsigned int id = strings.size();
+	strings.push_back(str);
+	table[pos].hash = h;
+	table[pos].id = id;
+	/* keep the load factor below 1/2 */
+	if (2 * (strings.size() - 1) > mask) grow();
+	pthread_mutex_unlock(&lock);
+	return id;
+}
+
+const char*
+StringPool::str(unsigned int id) const {
+	pthread_mutex_lock(&lock);
+	const char* s = strings[id];
+	pthread_mutex_unlock(&lock);
+	return s;
+}
+
+size_t
+StringPool::size() const {
+	pthread_mutex_lock(&lock);
+	size_t n = strings.size() - 1;
+	pthread_mutex_unlock(&lock);
+	return n;
+}
+
+size_t
+StringPool::bytes() const {
+	pthread_mutex_lock(&lock);
+	size_t n = arena.bytes() + (mask + 1) * sizeof(Entry)
+		+ strings.capacity() * sizeof(const char*);
+	pthread_mutex_unlock(&lock);
+	return n;
+}
+
+}
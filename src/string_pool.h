@@ -0,0 +1,85 @@
+/* ===========================================================================
+ *        Filename:  string_pool.h
+ *     Description:  Interning table for unified strings
+ *
+ *         Version:  $Rev$
+ *         Changed:  $Date$
+ *         Licence:  GPL (read COPYING file for details)
+ *
+ *          Author:  Erich Schubert (eS), erich@debian.org
+ *                   Institut für Informatik, LMU München
+ * ======================================================================== */
+#ifndef  SSD_STRING_POOL_H
+#define  SSD_STRING_POOL_H
+
+#include "config.h"
+#include "util.h"
+#include "arena.h"
+
+#include <vector>
+#include <pthread.h>
+
+namespace SSD {
+
+/** \brief Interning table storing each distinct string exactly once
+ *
+ *  Each string is assigned a dense integer id on first insertion, starting
+ *  at 1 (0 is reserved for the empty string). Ids are handed out in order
+ *  of first occurrence, so they do not depend on memory addresses. When
+ *  several threads intern concurrently (see Doc::loadPair) the order
+ *  depends on their interleaving; the diff results do not depend on the
+ *  id order.
+ *
+ *  All operations are serialized by a mutex, so one pool can be shared
+ *  by threads loading different documents.
+ *
+ *  The string data lives in an arena. The table uses open addressing with
+ *  linear probing and caches the hash value of each string, so the hash
+ *  is computed only once per lookup and never again when the table grows. */
+class StringPool {
+private:
+	/** \brief slot in the open addressing table */
+	struct Entry {
+		/** \brief cached hash value of the string */
+		size_t		hash;
+		/** \brief string id, 0 for empty slots */
+		unsigned int	id;
+	};
+	/** \brief open addressing table, size is a power of two */
+	Entry*	table;
+	/** \brief table size minus one */
+	size_t	mask;
+	/** \brief strings by id, index 0 is the NULL string */
+	std::vector<const char*> strings;
+	/** \brief storage for the string data */
+	Arena	arena;
+	/** \brief serializes access from concurrent loaders */
+	mutable pthread_mutex_t	lock;
+
+	/** \brief double the table size */
+	void grow();
+	/** \brief no copying */
+	StringPool(const StringPool&);
+	/** \brief no copying */
+	StringPool& operator=(const StringPool&);
+public:
+	/** \brief make an empty string pool */
+	StringPool();
+	/** \brief destructor, releasing all strings at once */
+	~StringPool();
+	/** \brief find or insert a string
+	 *  \param s zero terminated string, not NULL
+	 *  \return id of the string */
+	unsigned int intern(const char* s);
+	/** \brief get the string for an id
+	 *  \param id string id as returned by intern()
+	 *  \return the unique copy of the string, NULL for id 0 */
+	const char* str(unsigned int id) const;
+	/** \brief number of distinct strings stored */
+	size_t size() const;
+	/** \brief number of bytes used by the pool */
+	size_t bytes() const;
+};
+
+}
+#endif   /* ----- #ifndef SSD_STRING_POOL_H  ----- */
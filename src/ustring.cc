@@ -17,70 +17,34 @@ using namespace std;
 
 namespace SSD {
 
-	ustring::ustring(const char* s) {
-		const char* string=s;
-		if (!s) {
-			cstr = NULL;
-			return;
-		}
-
+	const char* ustring::normalize(const char* s) {
+		if (!s) return NULL;
 #ifndef KEEP_WHITESPACE
 		/* skip all whitespace */
-		while(isspace(*string)) { string++; }
+		while(isspace(*s)) { s++; }
 		/* empty strings are also NULL */
 #endif
-		if (!*string) {
-			cstr = NULL;
-			return;
-		}
+		if (!*s) return NULL;
+		return s;
+	}
 
+	ustring::ustring(const char* s) {
+		const char* string = normalize(s);
 		/* unify text string */
-		hashmap< const char*, const char*, hashstr, eq_str>::iterator iter = store.find(string);
-		if (iter == store.end()) {
-			/* duplicate string */
-			cstr = strdup(string);
-			/* insert into hashmap */
-			store[cstr]=cstr;
-		} else
-			/* return same string as before */
-			cstr = iter->second;
-		return;
+		sid = string ? store->intern(string) : 0;
 	}
 
 	ustring::ustring(const xmlChar* s) {
-		const char* string=(const char*) s;
-		if (!s) {
-			cstr = NULL;
-			return;
-		}
-
-#ifndef KEEP_WHITESPACE
-		/* skip all whitespace */
-		while(isspace(*string)) { string++; }
-		/* empty strings are also NULL */
-#endif
-		if (!*string) {
-			cstr = NULL;
-			return;
-		}
-
+		const char* string = normalize((const char*) s);
 		/* unify text string */
-		hashmap< const char*, const char*, hashstr, eq_str>::iterator iter = store.find(string);
-		if (iter == store.end()) {
-			/* duplicate string */
-			cstr = strdup(string);
-			/* insert into hashmap */
-			store.insert(make_pair(cstr,cstr));
-		} else
-			/* return same string as before */
-			cstr = iter->second;
-		return;
+		sid = string ? store->intern(string) : 0;
 	}
 
 	std::ostream &operator<<(std::ostream &out, const ustring& str) {
-		if (str.cstr) out << str.cstr;
+		if (str.sid) out << str.c_str();
 		return out;
 	}
 
-	hashmap< const char*, const char*, hashstr, eq_str> ustring::store;
+	StringPool ustring::global;
+	StringPool* ustring::store = &ustring::global;
 }
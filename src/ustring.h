@@ -14,6 +14,7 @@
 
 #include "config.h"
 #include "util.h"
+#include "string_pool.h"
 
 #include <iostream>
 #include <map>
@@ -33,13 +34,20 @@ struct eq_str {
 
 /** \brief Class which stores each string only once and enables faster comparision */
 /** by storing only one copy of each string, we can reduce string comparisions to
- *  pointer comparisions, which speeds up live a lot... */
+ *  integer comparisions, which speeds up live a lot... Each unified string is
+ *  represented by its dense id in the string pool, so the ordering is given by
+ *  the order of first occurrence and does not vary from run to run. */
 class ustring {
-	/** \brief string this represents */
-	const char* cstr;
+	/** \brief id of the string this represents, 0 for the empty string */
+	unsigned int sid;
 
-	/** \brief global store for "unified" strings */
-	static hashmap< const char*, const char*, hashstr, eq_str> store;
+	/** \brief store for "unified" strings, the pool of the active session */
+	static StringPool* store;
+	/** \brief store used when no session is active */
+	static StringPool global;
+
+	/** \brief strip leading whitespace, map empty strings to NULL */
+	static const char* normalize(const char* s);
 public:
 	/** \brief unify a char string */
 	/** \param s char string to be unified */
@@ -47,41 +55,50 @@ public:
 	/** \brief unify an xmlChar string */
 	/** \param s xmlChar string to be unified */
 	ustring(const xmlChar* s);
+	/** \brief select the pool new strings are stored in
+	 *  this is used by DiffSession; strings from different pools must
+	 *  never be compared.
+	 *  \param pool string pool to be used, NULL for the global pool */
+	static void setPool(StringPool* pool) { store = pool ? pool : &global; }
 
-	/** \brief trivial compare operators using pointer value */
+	/** \brief trivial compare operators using the string id */
 	/** \param other ustring to be compared with */
 	bool operator==(const ustring other) const {
-		return (cstr == other.cstr);
+		return (sid == other.sid);
 	}
-	/** \brief trivial compare operators using pointer value */
+	/** \brief trivial compare operators using the string id */
 	/** \param other ustring to be compared with */
 	bool operator<=(const ustring other) const {
-		return (cstr <= other.cstr);
+		return (sid <= other.sid);
 	}
-	/** \brief trivial compare operators using pointer value */
+	/** \brief trivial compare operators using the string id */
 	/** \param other ustring to be compared with */
 	bool operator<(const ustring other) const {
-		return (cstr < other.cstr);
+		return (sid < other.sid);
 	}
-	/** \brief trivial compare operators using pointer value */
+	/** \brief trivial compare operators using the string id */
 	/** \param other ustring to be compared with */
 	bool operator>=(const ustring other) const {
-		return (cstr >= other.cstr);
+		return (sid >= other.sid);
 	}
-	/** \brief trivial compare operators using pointer value */
+	/** \brief trivial compare operators using the string id */
 	/** \param other ustring to be compared with */
 	bool operator>(const ustring other) const {
-		return (cstr > other.cstr);
+		return (sid > other.sid);
 	}
-	/** \brief trivial compare operators using pointer value */
+	/** \brief trivial compare operators using the string id */
 	/** \param other ustring to be compared with */
 	bool operator!=(const ustring other) const {
-		return (cstr != other.cstr);
+		return (sid != other.sid);
 	}
 	/** \brief test if this actually represents a nonempty string */
-	bool empty() const { return (cstr == NULL); }
-	/** \brief hash function is just using the pointer value */
-	size_t hash() const { return reinterpret_cast<size_t>(cstr); }
+	bool empty() const { return (sid == 0); }
+	/** \brief dense id of this string, 0 for the empty string */
+	unsigned int id() const { return sid; }
+	/** \brief character data of this string, NULL for the empty string */
+	const char* c_str() const { return store->str(sid); }
+	/** \brief hash function, mixing the string id */
+	size_t hash() const { return mix64(sid); }
 
 	/** \brief append ustring to output stream for easier writing */
 	/** \param out output stream to be appended to
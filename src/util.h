@@ -13,6 +13,7 @@
 #define  UTIL_INC
 
 #include <string.h>
+#include <stdint.h>
 #include <tr1/unordered_map>
 
 /** \brief Hashmap implementation to use */
@@ -25,13 +26,62 @@
 /** \brief maximum macro */
 #define MAX(a,b) (( (a>=b) ? a : b ))
 
+/** \brief increment a reference count, which may be shared by threads */
+#define REF_INC(x) __atomic_add_fetch(&(x), 1, __ATOMIC_RELAXED)
+/** \brief decrement a reference count, which may be shared by threads
+ *  \return the new count */
+#define REF_DEC(x) __atomic_sub_fetch(&(x), 1, __ATOMIC_ACQ_REL)
+/** \brief read a reference count, which may be shared by threads */
+#define REF_GET(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+
+/** \brief FNV-1a hash of a zero terminated string
+ *  \param s string to be hashed
+ *  \param len optional return parameter: length of the string
+ *  \return hash value */
+static inline std::size_t hash_cstr(const char* s, std::size_t* len = NULL) {
+	std::size_t h = (sizeof(std::size_t) > 4) ?
+		(std::size_t) 14695981039346656037ULL : (std::size_t) 2166136261UL;
+	const std::size_t prime = (sizeof(std::size_t) > 4) ?
+		(std::size_t) 1099511628211ULL : (std::size_t) 16777619UL;
+	const unsigned char* p = (const unsigned char*) s;
+	for (; *p; p++) {
+		h ^= *p;
+		h *= prime;
+	}
+	if (len) *len = p - (const unsigned char*) s;
+	return h;
+}
+
+/** \brief 64 bit FNV-1a hash of a block of memory
+ *  \param data memory to be hashed
+ *  \param len number of bytes
+ *  \return hash value */
+static inline uint64_t hash_bytes(const void* data, std::size_t len) {
+	uint64_t h = 14695981039346656037ULL;
+	const unsigned char* p = (const unsigned char*) data;
+	for (const unsigned char* e = p + len; p != e; p++) {
+		h ^= *p;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/** \brief mix the bits of a 64 bit key (MurmurHash3 finalizer)
+ *  \param k key to be mixed
+ *  \return hash value */
+static inline std::size_t mix64(uint64_t k) {
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return (std::size_t) k;
+}
+
 /** \brief hash function for char* 'strings' */
 struct hashstr {
 	std::size_t operator()(const char* s) const {
-		/* I'm not sure how portable this references is.
-		 * It's accessing an internal part of the TR1 implementation */
-	        return 0;
-		//return std::tr1::hash(s, strlen(s));
+		return hash_cstr(s);
 	}
 };
 
@@ -12,4 +12,9 @@ echo $DIR_TEST > brio
    diff output.xml $DIR_TEST/result.xml
 '
 
+test_expect_success "read a document from a pipe" '
+   cat $DIR_TEST/operations2.xml | $SHARNESS_BUILD_DIRECTORY/src/xmldiff $DIR_TEST/operations1.xml - > piped.xml &&
+   diff piped.xml $DIR_TEST/result.xml
+'
+
 test_done
@@ -0,0 +1,44 @@
+#!/bin/sh
+
+test_description="Snapshot cache of preprocessed documents"
+
+. ./setup.sh
+
+DIR_DATA=$SHARNESS_TEST_DIRECTORY/t0001
+
+test_expect_success "diff filling the cache" '
+   mkdir cache &&
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -c cache $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml > output.xml &&
+   diff output.xml $DIR_DATA/result.xml &&
+   test $(ls cache/*.snap | wc -l) = 2
+'
+
+# a rewritten snapshot is renamed into place and gets a new inode
+test_expect_success "diff using the cache" '
+   ls -il cache > before.txt && cksum cache/*.snap >> before.txt &&
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -c cache $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml > output.xml &&
+   diff output.xml $DIR_DATA/result.xml &&
+   ls -il cache > after.txt && cksum cache/*.snap >> after.txt &&
+   diff before.txt after.txt
+'
+
+test_expect_success "damaged snapshots are ignored" '
+   for f in cache/*.snap; do head -c 100 $f > $f.cut && mv $f.cut $f; done &&
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -c cache $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml > output.xml &&
+   diff output.xml $DIR_DATA/result.xml
+'
+
+test_expect_success "snapshots shorter than their header are ignored" '
+   for f in cache/*.snap; do head -c 4 $f > $f.cut && mv $f.cut $f; done &&
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -c cache $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml > output.xml &&
+   diff output.xml $DIR_DATA/result.xml
+'
+
+test_expect_success "documents from a pipe bypass the cache" '
+   mkdir pipecache &&
+   cat $DIR_DATA/operations2.xml | $SHARNESS_BUILD_DIRECTORY/src/xmldiff -c pipecache $DIR_DATA/operations1.xml - > output.xml &&
+   diff output.xml $DIR_DATA/result.xml &&
+   test $(ls pipecache/*.snap | wc -l) = 1
+'
+
+test_done
@@ -0,0 +1,29 @@
+#!/bin/sh
+
+test_description="Beam search between the fast and the exact mode"
+
+. ./setup.sh
+
+DIR_DATA=$SHARNESS_TEST_DIRECTORY/t0001
+
+test_expect_success "beam of width 1 equals the fast mode" '
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -b 1 $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml > output.xml 2> cost.txt &&
+   diff output.xml $DIR_DATA/result.xml
+'
+
+test_expect_success "beam search reports the cost reached" '
+   grep "^Beam search of width 1 reached cost [0-9]*$" cost.txt
+'
+
+test_expect_success "wide beam finds the exact result" '
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -e $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml > exact.xml &&
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -b 1000 $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml > output.xml &&
+   diff output.xml exact.xml
+'
+
+test_expect_success "beam width must be positive" '
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -b 0 $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml 2> usage.txt &&
+   grep "^Usage:" usage.txt
+'
+
+test_done
@@ -0,0 +1,38 @@
+#!/bin/sh
+
+test_description="Weighted search with bounded costs"
+
+. ./setup.sh
+
+DIR_DATA=$SHARNESS_TEST_DIRECTORY/t0001
+
+test_expect_success "weight 1 finds the exact result" '
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -e $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml > exact.xml &&
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -s 1 $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml > output.xml 2> cost1.txt &&
+   diff output.xml exact.xml
+'
+
+test_expect_success "weighted search reports the cost reached" '
+   grep "^Weighted search of weight 1 reached cost [0-9]*$" cost1.txt
+'
+
+test_expect_success "higher weights stay within their bound" '
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -n -s 1 $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml 2>&1 > /dev/null | sed "s/.* //" > best.txt &&
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -n -s 4 $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml 2>&1 > /dev/null | sed "s/.* //" > cost4.txt &&
+   test $(cat cost4.txt) -le $((4 * $(cat best.txt)))
+'
+
+test_expect_success "huge weights still give a result" '
+   for w in 1e9 1e300 inf; do
+      $SHARNESS_BUILD_DIRECTORY/src/xmldiff -n -s $w $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml > output.xml 2> costw.txt &&
+      grep "</" output.xml &&
+      grep "^Weighted search of weight [0-9e+inf]* reached cost [0-9]*$" costw.txt || return 1
+   done
+'
+
+test_expect_success "weight must be at least 1" '
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -s 0.5 $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml 2> usage.txt &&
+   grep "^Usage:" usage.txt
+'
+
+test_done
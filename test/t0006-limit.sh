@@ -0,0 +1,39 @@
+#!/bin/sh
+
+test_description="Exact search with a limited number of states"
+
+. ./setup.sh
+
+DIR_DATA=$SHARNESS_TEST_DIRECTORY/t0001
+
+test_expect_success "a generous limit keeps the exact result" '
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -n -e $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml > exact.xml &&
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -n -e -l 100 $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml > output.xml 2> report.txt &&
+   diff output.xml exact.xml
+'
+
+test_expect_success "the result is reported as optimal" '
+   grep "^Search evicted [0-9]* states, the result is proven optimal$" report.txt
+'
+
+test_expect_success "a tight limit still gives a result" '
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -n -e -l 1 $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml > output.xml 2> report.txt &&
+   grep "</" output.xml &&
+   grep "^Search evicted [0-9]* states, the result is not proven optimal$" report.txt
+'
+
+test_expect_success "the limit must be positive" '
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -l 0 $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml 2> usage.txt &&
+   grep "^Usage:" usage.txt
+'
+
+test_expect_success "the limit needs the exact or weighted mode" '
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -l 100 $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml 2> fast.txt &&
+   grep "^Usage:" fast.txt &&
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -l 100 -b 10 $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml 2> beam.txt &&
+   grep "^Usage:" beam.txt &&
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -l 100 -s 2 $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml > output.xml &&
+   grep "</" output.xml
+'
+
+test_done
@@ -0,0 +1,30 @@
+#!/bin/sh
+
+test_description="Anytime search with a deadline"
+
+. ./setup.sh
+
+DIR_DATA=$SHARNESS_TEST_DIRECTORY/t0001
+
+test_expect_success "enough time gives the exact result" '
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -n -e $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml > exact.xml &&
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -n --deadline 60 $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml > output.xml 2> report.txt &&
+   diff output.xml exact.xml
+'
+
+test_expect_success "the result is reported as optimal" '
+   grep "^Anytime search reached cost [0-9]*, the result is proven optimal$" report.txt
+'
+
+test_expect_success "no time still gives a result" '
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -n -d 0.000001 $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml > output.xml 2> report.txt &&
+   grep "</" output.xml &&
+   grep "^Anytime search reached cost [0-9]*, the result is \(not \)\?proven optimal$" report.txt
+'
+
+test_expect_success "the deadline must be positive" '
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -d 0 $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml 2> usage.txt &&
+   grep "^Usage:" usage.txt
+'
+
+test_done
@@ -0,0 +1,60 @@
+#!/bin/sh
+
+test_description="Parallel exact search"
+
+. ./setup.sh
+
+DIR_DATA=$SHARNESS_TEST_DIRECTORY/t0001
+
+test_expect_success "the parallel search reports its cost" '
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -n -e -j 2 $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml > output.xml 2> report.txt &&
+   grep "</" output.xml &&
+   grep "^Parallel search on 2 threads reached cost [0-9]*$" report.txt
+'
+
+test_expect_success "the cost is the one of the exact search" '
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -n -e -s 1 $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml > exact.xml 2> exact.txt &&
+   sed -n "s/^Weighted search of weight 1 reached cost //p" exact.txt > expected.txt &&
+   sed -n "s/^Parallel search on 2 threads reached cost //p" report.txt > actual.txt &&
+   test -s expected.txt &&
+   diff expected.txt actual.txt
+'
+
+test_expect_success "two threads give the exact result" '
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -n -e $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml > exact.xml &&
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -n -e -j 2 $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml > output.xml &&
+   diff output.xml exact.xml
+'
+
+test_expect_success "four threads give the exact result" '
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -n -e -j 4 $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml > output.xml &&
+   diff output.xml exact.xml
+'
+
+test_expect_success "the attributes are matched as without threads" '
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -e $SHARNESS_TEST_DIRECTORY/t0002/ops-attr1.xml $SHARNESS_TEST_DIRECTORY/t0002/ops-attr2.xml > exact.xml &&
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -e -j 2 $SHARNESS_TEST_DIRECTORY/t0002/ops-attr1.xml $SHARNESS_TEST_DIRECTORY/t0002/ops-attr2.xml > output.xml &&
+   diff output.xml exact.xml
+'
+
+test_expect_success "one thread gives the exact result" '
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -n -e $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml > exact.xml &&
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -n -e -j 1 $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml > output.xml &&
+   diff output.xml exact.xml
+'
+
+test_expect_success "at least one thread is needed" '
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -j 0 $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml 2> usage.txt &&
+   grep "^Usage:" usage.txt
+'
+
+test_expect_success "threads are only used by the exact mode" '
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -j 2 $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml 2> fast.txt &&
+   grep "^Usage:" fast.txt &&
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -j 2 -s 1 $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml 2> weighted.txt &&
+   grep "^Usage:" weighted.txt &&
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -e -j 2 -l 100 $DIR_DATA/operations1.xml $DIR_DATA/operations2.xml 2> limit.txt &&
+   grep "^Usage:" limit.txt
+'
+
+test_done
@@ -0,0 +1,31 @@
+#!/bin/sh
+
+test_description="Relations built by several threads"
+
+. ./setup.sh
+
+# large enough for four relation building threads
+test_expect_success "generate large documents" '
+   awk "BEGIN { print \"<root>\"; for (i = 0; i < 6000; i++) printf \"<item id=\\\"i%d\\\"><name>item %d</name></item>\\n\", i, i % 500; print \"</root>\" }" > doc1.xml &&
+   sed "s/\"i42\"/\"x42\"/; s/<name>item 7</<name>item seven</" doc1.xml > doc2.xml &&
+   test $(grep -c "<item" doc1.xml) = 6000 &&
+   ! cmp doc1.xml doc2.xml
+'
+
+for p in "./node() | ./*/node()" "./node() | ./*/text()"; do
+   test_expect_success "the same relations on one and four threads for $p" '
+      rm -rf cache1 cache4 && mkdir cache1 cache4 &&
+      $SHARNESS_BUILD_DIRECTORY/src/xmldiff -r 1 -p "$p" -c cache1 doc1.xml doc2.xml > output1.xml &&
+      $SHARNESS_BUILD_DIRECTORY/src/xmldiff -r 4 -p "$p" -c cache4 doc1.xml doc2.xml > output4.xml &&
+      diff output1.xml output4.xml &&
+      test $(ls cache1/*.snap | wc -l) = 2 &&
+      for f in cache1/*.snap; do cmp $f cache4/${f#cache1/} || return 1; done
+   '
+done
+
+test_expect_success "at least one thread is needed" '
+   $SHARNESS_BUILD_DIRECTORY/src/xmldiff -r 0 doc1.xml doc2.xml 2> usage.txt &&
+   grep "^Usage:" usage.txt
+'
+
+test_done